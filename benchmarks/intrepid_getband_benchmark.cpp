@@ -0,0 +1,139 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+//Builds a synthetic Intrepid line database and compares ILSegment::getband()/getbands() against the per sample d() accessor
+//Usage: intrepid_getband_benchmark [datasetdir] [nlines] [nsamples]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <chrono>
+#include "logger.h"
+#include "intrepid.h"
+
+cLogger glog;
+
+using clk = std::chrono::steady_clock;
+
+//Writes the 512 byte header of a little endian .PD file
+void writeheader(FILE* fp, int16_t filetype, int16_t dt, int16_t ds, int16_t access, int32_t a, int32_t b, int32_t nbands)
+{
+	int16_t s[256] = {};
+	s[72] = filetype;
+	s[73] = dt;
+	s[90] = ds;
+	s[91] = access;
+	s[81] = 1;
+	s[78] = nbands > 1 ? 2 : 1;//BIP
+	std::memcpy(&s[217], &a, 4);
+	std::memcpy(&s[219], &b, 4);
+	std::memcpy(&s[221], &nbands, 4);
+	fwrite(s, sizeof(s), 1, fp);
+}
+
+template<typename T>
+void writefield(const std::string& dir, const std::string& name, int16_t dt, const std::vector<int>& counts, const size_t maxspl, const int32_t nbands, const double nullfraction, std::mt19937& rng)
+{
+	FILE* fp = fileopen(dir + name + ".PD", "wb");
+	writeheader(fp, 1000, dt, (int16_t)(8 * sizeof(T)), 2, (int32_t)maxspl, (int32_t)counts.size(), nbands);
+	std::uniform_real_distribution<double> u(0.0, 1.0);
+	const T null = IDataType::nullvalue<T>();
+	std::vector<T> v;
+	for (size_t li = 0; li < counts.size(); li++) {
+		v.resize((size_t)counts[li] * nbands);
+		for (size_t k = 0; k < v.size(); k++) {
+			v[k] = u(rng) < nullfraction ? null : (T)(100.0 * u(rng));
+		}
+		fwrite(v.data(), sizeof(T), v.size(), fp);
+	}
+	fclose(fp);
+	fclose(fileopen(dir + name + ".PD.vec", "w"));
+}
+
+void builddataset(const std::string& dir, const size_t nlines, const size_t nsamples)
+{
+	std::filesystem::create_directories(dir);
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> ns((int)(nsamples * 3 / 4), (int)(nsamples * 5 / 4));
+	std::vector<int> counts(nlines);
+	size_t maxspl = 0;
+	for (size_t li = 0; li < nlines; li++) {
+		counts[li] = ns(rng);
+		maxspl = std::max(maxspl, (size_t)counts[li]);
+	}
+
+	FILE* fp = fileopen(dir + "INDEX.PD", "wb");
+	writeheader(fp, 1002, 2, 32, 2, (int32_t)nlines, (int32_t)maxspl, 1);
+	int32_t start = 0;
+	for (size_t li = 0; li < nlines; li++) {
+		const int32_t rec[4] = { start, counts[li], 0, 0 };
+		fwrite(rec, sizeof(rec), 1, fp);
+		start += counts[li];
+	}
+	fclose(fp);
+
+	fp = fileopen(dir + "SurveyInfo", "w");
+	fprintf(fp, "X = DBL\nY = FLT\n");
+	fclose(fp);
+
+	writefield<double>(dir, "DBL", 3, counts, maxspl, 1, 0.01, rng);
+	writefield<float>(dir, "FLT", 3, counts, maxspl, 1, 0.01, rng);
+	writefield<int32_t>(dir, "INT", 2, counts, maxspl, 1, 0.01, rng);
+	writefield<int16_t>(dir, "SHT", 2, counts, maxspl, 1, 0.01, rng);
+	writefield<uint8_t>(dir, "UBY", 1, counts, maxspl, 1, 0.0, rng);
+	writefield<float>(dir, "FLT5", 3, counts, maxspl, 5, 0.01, rng);
+}
+
+int main(int argc, char** argv)
+{
+	std::string dir = argc > 1 ? argv[1] : (std::filesystem::temp_directory_path() / "intrepid_getband_benchmark").string();
+	const size_t nlines = argc > 2 ? (size_t)std::atol(argv[2]) : 200;
+	const size_t nsamples = argc > 3 ? (size_t)std::atol(argv[3]) : 5000;
+	addtrailingseparator(dir);
+
+	builddataset(dir, nlines, nsamples);
+	ILDataset D(dir);
+	if (D.valid == false) {
+		std::printf("Could not open the synthetic dataset %s\n", dir.c_str());
+		return 1;
+	}
+
+	std::printf("%zu lines x ~%zu samples in %s\n", nlines, nsamples, dir.c_str());
+	std::printf("%-6s %12s %12s %12s %8s\n", "field", "d() s", "getband s", "getbands s", "speedup");
+	size_t mismatches = 0;
+	for (ILField& F : D.Fields) {
+		double td = 0.0, tb = 0.0, tbs = 0.0;
+		std::vector<double> a, b;
+		std::vector<std::vector<double>> bands;
+		for (size_t li = 0; li < D.nlines(); li++) {
+			ILSegment S(F, li);
+			S.readbuffer();
+			const size_t ns = S.nsamples();
+			a.resize(ns);
+			b.resize(ns);
+			for (size_t bi = 0; bi < S.nbands(); bi++) {
+				auto t0 = clk::now();
+				for (size_t si = 0; si < ns; si++) a[si] = S.d(si, bi);
+				auto t1 = clk::now();
+				S.getband(b.data(), ns, bi);
+				auto t2 = clk::now();
+				td += std::chrono::duration<double>(t1 - t0).count();
+				tb += std::chrono::duration<double>(t2 - t1).count();
+				for (size_t si = 0; si < ns; si++) {
+					if (a[si] != b[si] && !(IDataType::isnull(a[si]) && b[si] == IDataType::doublenull())) mismatches++;
+				}
+			}
+			auto t0 = clk::now();
+			S.getbands(bands);
+			tbs += std::chrono::duration<double>(clk::now() - t0).count();
+		}
+		std::printf("%-6s %12.4f %12.4f %12.4f %7.1fx\n", F.getName().c_str(), td, tb, tbs, td / tb);
+	}
+	std::printf("mismatches %zu\n", mismatches);
+	return mismatches == 0 ? 0 : 1;
+}
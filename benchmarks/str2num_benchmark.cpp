@@ -0,0 +1,77 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+//Compares str2num_fast against the std::istringstream >> v path it replaced in getcolumn/getcolumn_val
+//Usage: str2num_benchmark [nvalues]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "string_utils.h"
+#include "stopwatch.h"
+
+template<typename T>
+T sum_stream(const std::vector<std::string>& v)
+{
+	T sum = 0;
+	for (const std::string& s : v) {
+		T x = 0;
+		std::istringstream(s) >> x;
+		sum += x;
+	}
+	return sum;
+}
+
+template<typename T>
+T sum_fast(const std::vector<std::string>& v)
+{
+	T sum = 0;
+	for (const std::string& s : v) {
+		T x = 0;
+		str2num_fast(s, x);
+		sum += x;
+	}
+	return sum;
+}
+
+template<typename T>
+bool run(const char* name, const std::vector<std::string>& v)
+{
+	cStopWatch sw;
+	const T s1 = sum_stream<T>(v);
+	const double t1 = sw.etimenow();
+	sw.reset();
+	const T s2 = sum_fast<T>(v);
+	const double t2 = sw.etimenow();
+	const bool agree = (s1 == s2);
+	std::printf("%-10s n=%zu stream %.3fs from_chars %.3fs speedup %.1fx %s\n", name, v.size(), t1, t2, t1 / t2, agree ? "agree" : "DISAGREE");
+	return agree;
+}
+
+int main(int argc, char** argv)
+{
+	const size_t n = argc > 1 ? (size_t)std::atol(argv[1]) : 2000000;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> ureal(-1e5, 1e5);
+	std::uniform_int_distribution<int> uinteger(-100000, 100000);
+
+	char buf[64];
+	std::vector<std::string> e(n), f(n), i(n);
+	for (size_t k = 0; k < n; k++) {
+		const double x = ureal(rng);
+		std::snprintf(buf, sizeof(buf), "%15.6E", x); e[k] = buf;
+		std::snprintf(buf, sizeof(buf), "%12.3f", x); f[k] = buf;
+		std::snprintf(buf, sizeof(buf), "%d", uinteger(rng)); i[k] = buf;
+	}
+
+	bool ok = true;
+	ok &= run<double>("%15.6E", e);
+	ok &= run<double>("%12.3f", f);
+	ok &= run<int>("%d", i);
+	return ok ? 0 : 1;
+}
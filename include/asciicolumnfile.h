@@ -15,6 +15,14 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <vector>
 #include <filesystem>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <memory>
+#include <array>
+#include <type_traits>
 
 
 #include "csv.hpp"
@@ -23,13 +31,84 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include "file_formats.h"
 #include "general_types.h"
 #include "fielddefinition.h"
+#include "memorymappedfile.h"
+#include "blockprefetcher.h"
 
 #ifdef ENABLE_MPI
 #include "mpi_wrapper.h"
 #endif
 
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#include <climits>
+#endif
+
+//Precomputed character slice of a single column (band) of a fixed width record
+struct cColumnSlice {
+	size_t offset = 0;//Zero based character index of the column
+	size_t width = 0;
+	std::string nullstring;//Column strings matching this are treated as empty (null)
+};
+
+//A parsed record that is independent of cAsciiColumnFile's current record, so that records can be parsed concurrently
+class cAsciiColumnRecord {
+
+public:
+	size_t index = 0;//Zero based record number in the file
+	std::string_view str;//The record (without the "\n")
+	std::vector<std::string_view> columns;//Trimmed column strings, empty for nulls
+	const std::vector<cAsciiColumnField>* pfields = nullptr;
+
+	template<typename T>
+	static void getcolumn(const std::vector<std::string_view>& columns, const std::string_view str, const size_t& columnnumber, T& v)
+	{
+		if (columnnumber >= columns.size()) {
+			std::string msg = _SRC_;
+			msg += strprint("\n\tError trying to access column %zu when there are only %zu columns in the current record string (check format and delimiters)\nCurrent record is\n%s\n", columnnumber + 1, columns.size(), std::string(str).c_str());
+			throw(std::runtime_error(msg));
+		}
+		field2num(columns[columnnumber], v);
+	};
+
+	template<typename T>
+	void getcolumn(const size_t& columnnumber, T& v) const
+	{
+		getcolumn(columns, str, columnnumber, v);
+	};
+
+	template<typename T>
+	void getfieldbyindex(const size_t& findex, T& v) const
+	{
+		getcolumn((size_t)(*pfields)[findex].startcol(), v);
+	};
+
+	template<typename T>
+	void getfieldbyindex(const size_t& findex, std::vector<T>& vec) const
+	{
+		const cAsciiColumnField& f = (*pfields)[findex];
+		vec.resize(f.nbands);
+		for (size_t bi = 0; bi < f.nbands; bi++) {
+			getcolumn(f.startcol() + bi, vec[bi]);
+		}
+	};
+};
+
+//Summary of one column (a band of a field) of a data file from cAsciiColumnFile::profile_columns()
+class cColumnProfile {
+
+public:
+	size_t fieldindex = 0;
+	size_t band = 0;
+	std::string name;//Field name, with the band number appended for multi band fields
+	cStats<double> stats;//stats.nulls counts the empty columns and those matching the field's null string
+	cHistogram<double, size_t> histogram;
+};
+
 class cAsciiColumnFile {
 
+public:
+	enum class ReadMode { STREAM, MMAP };
+
 private:
 	static constexpr int newline = 10;
 	static constexpr int carriagereturn = 13;
@@ -37,69 +116,597 @@ private:
 	std::string FileName;
 	size_t FileSize = 0;
 	size_t RecordLength = 0;//Length in bytes of records including "\r\n" or "\n"
-	std::string CurrentRecord;
-	std::vector<std::string> colstrings;
+	mutable std::string CurrentRecord;
+	std::string_view RecordView;//The current record (without the "\n"), a view into either CurrentRecord or the mapping
+	mutable std::vector<std::string_view> colviews;//Trimmed column strings of the current record, views into RecordView
+	mutable std::vector<std::string> colstrings;//Only materialised from colviews on request
+	mutable bool colstrings_current = false;
+
+	//Related to fixed width parsing
+	std::vector<cColumnSlice> ColumnSlices;
+	bool columnslices_valid = false;
+
+	//Related to projection, only the NeededColumns are parsed by parse_record() and the others on demand
+	static constexpr std::string_view delimiters = " ,\t\r\n";
+	std::vector<size_t> NeededColumns;//Sorted zero based column numbers, empty for all columns
+	size_t RecordGeneration = 0;//Incremented by parse_record()
+	mutable std::vector<size_t> ColumnGeneration;//Fixed width: the RecordGeneration in which each column view was parsed
+	mutable size_t DelimitedNParsed = 0;//Delimited: number of leading columns tokenised
+	mutable size_t DelimitedResume = 0;//Delimited: offset in RecordView after the last tokenised column
+
+	//Related to memory mapped reading
+	ReadMode readmode = ReadMode::STREAM;
+	cMemoryMappedFile MMF;
+	size_t MapPos = 0;//Byte offset of the start of the next record in the mapping
+	bool MapEof = false;
+
+	//Related to variable length (delimited) records
+	bool VariableLength = false;
+	size_t OffsetStride = 0;//The byte offset of every OffsetStride'th record is indexed, 0 if there is no index
+	std::vector<size_t> RecordOffsets;//Byte offsets of records 0, OffsetStride, 2*OffsetStride, ...
+	size_t NRecordsIndexed = 0;
+	std::ifstream OffsetIFS;//STREAM mode: reused by record_offset() to skip from an indexed record without disturbing IFS
+	std::vector<char> OffsetBuffer;
+
+	//Related to reading a restricted range of records (eg this MPI rank's share)
+	size_t NextRecord = 0;//Zero based index of the record the next load_next_record() will read
+	size_t RangeFirst = 0;
+	size_t RangeEnd = undefinedvalue<size_t>();//One past the last record of the range
+	bool RangeEof = false;
+
+	cColumnarBatch GroupBatch;//Reused by the vector-of-vectors readnextgroup
+
+	//Related to background prefetching in STREAM mode
+	std::unique_ptr<cBlockPrefetcher> Prefetcher;
+	std::vector<char> PrefetchBlock;//Block of whole records currently being consumed
+	size_t PrefetchPos = 0;//Offset of the next record in PrefetchBlock
+	bool PrefetchEof = false;
+	size_t PrefetchBlockSize = 0;
+	size_t PrefetchNBlocks = 2;
+
+	//Related to gzip compressed input, which is inflated by the prefetch thread and can only be read sequentially
+	bool Compressed = false;
+	size_t NRecordsCounted = undefinedvalue<size_t>();//Known once a pass has reached the end of a compressed file
+	bool SeekWarned = false;
+
+	//Line index of a compressed file built as a side effect of the first sequential pass from its start that reaches the end,
+	//so that scan_for_line_index() never needs an inflating pass of its own
+	class cPassLineIndex {
+	public:
+		int field = -1;
+		bool active = false;//The current pass started at record 0 and has not skipped any
+		bool complete = false;
+		std::vector<unsigned int> start;
+		std::vector<unsigned int> count;
+		std::vector<unsigned int> number;
+
+		void setfield(const int& fi) {
+			if (fi == field) return;
+			field = fi;
+			invalidate();
+		}
+
+		void invalidate() {
+			active = complete = false;
+			start.clear();
+			count.clear();
+			number.clear();
+		}
+
+		void begin() {
+			if (field < 0 || complete) return;
+			invalidate();
+			active = true;
+		}
+
+		void abandon() { active = false; }
+
+		void add(const std::string_view record, const size_t& startchar, const size_t& width) {
+			int ival = 0;
+			if (startchar < record.size()) str2num_fast(record.substr(startchar, width), ival);
+			const unsigned int lnum = (unsigned int)ival;
+			const unsigned int nread = start.size() > 0 ? start.back() + count.back() : 0;
+			if (number.size() == 0 || lnum != number.back()) {
+				number.push_back(lnum);
+				start.push_back(nread);
+				count.push_back(1);
+			}
+			else {
+				count.back()++;
+			}
+		}
+
+		void finish() {
+			if (active) complete = true;
+			active = false;
+		}
+	};
+	cPassLineIndex PassLineIndex;
+
+	void add_to_pass_line_index(const std::string_view record) {
+		if (PassLineIndex.active) {
+			const cAsciiColumnField& f = fields[(size_t)PassLineIndex.field];
+			PassLineIndex.add(record, f.startchar, f.width);
+		}
+	}
+
+	//Hands out the records of a sequential reader (eg an inflating one) k at a time
+	class cRecordReader {
+		static constexpr size_t BlockSize = 1048576;
+		cBlockPrefetcher::ReadFunc Read;
+		std::vector<char> Pending;//Bytes read but not yet handed out
+		size_t PendingPos = 0;
+
+	public:
+		cRecordReader(cBlockPrefetcher::ReadFunc read) : Read(read) {};
+
+		//Puts the next k records (with their newlines) in buf and returns the number of records, fewer than k at the end of the input
+		size_t read_records(const size_t k, std::vector<char>& buf) {
+			buf.clear();
+			size_t n = 0;
+			while (n < k) {
+				if (PendingPos >= Pending.size()) {
+					Pending.resize(BlockSize);
+					Pending.resize(Read(Pending.data(), BlockSize));
+					PendingPos = 0;
+					if (Pending.size() == 0) {
+						if (buf.size() > 0 && buf.back() != newline) n++;//Last record has no trailing newline
+						break;
+					}
+				}
+				const char* p = Pending.data() + PendingPos;
+				const char* end = Pending.data() + Pending.size();
+				const char* q = p;
+				while (n < k && (q = findchar(q, end, newline)) != end) {
+					q++;
+					n++;
+				}
+				buf.insert(buf.end(), p, q);
+				PendingPos = (size_t)(q - Pending.data());
+			}
+			return n;
+		}
+	};
+
+	static bool is_gzip_file(const std::string& path) {
+		std::ifstream ifs(path, std::ifstream::in | std::ifstream::binary);
+		unsigned char magic[2] = { 0, 0 };
+		ifs.read((char*)magic, 2);
+		return ifs.gcount() == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+	}
+
+	//Reader of the (inflated if compressed) bytes of the file from byte offset with its own file handle
+	cBlockPrefetcher::ReadFunc make_reader(const size_t& offset) const {
+#ifdef ENABLE_ZLIB
+		if (Compressed) {
+			gzFile gz = gzopen(FileName.c_str(), "rb");
+			if (gz == NULL) {
+				glog.errormsg(_SRC_, "Could not open file %s\n", FileName.c_str());
+			}
+			gzbuffer(gz, 262144);
+			auto handle = std::shared_ptr<gzFile_s>(gz, [](gzFile g) { gzclose(g); });
+			const std::string filename = FileName;
+			if (offset > 0 && gzseek(gz, (z_off_t)offset, SEEK_SET) < 0) {
+				glog.errormsg(_SRC_, "Could not seek to byte %zu of compressed file %s\n", offset, FileName.c_str());
+			}
+			return [handle, filename](char* buf, const size_t n) -> size_t {
+				const int nread = gzread(handle.get(), buf, (unsigned int)std::min(n, (size_t)INT_MAX));
+				if (nread < 0) {
+					int errnum;
+					const char* zmsg = gzerror(handle.get(), &errnum);
+					throw(std::runtime_error(_SRC_ + strprint("\nError decompressing %s: %s\n", filename.c_str(), zmsg)));
+				}
+				return (size_t)nread;
+			};
+		}
+#endif
+		auto ifs = std::make_shared<std::ifstream>(FileName, std::ifstream::in | std::ifstream::binary);
+		if (!(*ifs)) {
+			glog.errormsg(_SRC_, "Could not open file %s\n", FileName.c_str());
+		}
+		ifs->seekg((std::streamoff)offset, std::ios::beg);
+		return [ifs](char* buf, const size_t n) -> size_t {
+			ifs->read(buf, (std::streamsize)n);
+			return (size_t)ifs->gcount();
+		};
+	}
+
+	//Counts the records of a compressed file in one inflating pass, building the line index in the same pass if a line index field is set
+	size_t count_compressed_records() {
+		PassLineIndex.begin();
+		if (PassLineIndex.active == false) return count_records();
+		cRecordReader reader(make_reader(0));
+		std::vector<char> buf;
+		size_t nr = 0;
+		size_t n;
+		while ((n = reader.read_records(4096, buf)) > 0) {
+			const char* p = buf.data();
+			const char* end = buf.data() + buf.size();
+			for (size_t k = 0; k < n; k++) {
+				const char* nl = findchar(p, end, newline);
+				add_to_pass_line_index(std::string_view(p, (size_t)(nl - p)));
+				p = (nl == end) ? end : nl + 1;
+			}
+			nr += n;
+		}
+		PassLineIndex.finish();
+		return nr;
+	}
+
+	//Counts the newlines read from the start of the file by a reader, plus one if the last record has no trailing newline
+	size_t count_records() const {
+		cBlockPrefetcher::ReadFunc read = make_reader(0);
+		const size_t blocksize = 4194304;
+		std::vector<char> buf(blocksize);
+		size_t nr = 0;
+		char last = newline;
+		while (true) {
+			const size_t nread = read(buf.data(), blocksize);
+			if (nread == 0) break;
+			nr += countchar(buf.data(), buf.data() + nread, newline);
+			last = buf[nread - 1];
+		}
+		if (last != newline) nr++;
+		return nr;
+	}
 
 	//Related to header parsing
 	bool charpositions_adjusted = false;
 	std::string ST_string;
 	std::string RT_string;
 
-	size_t determine_record_length_no_rewind() {
-		size_t k = 0;
-		while (true) {
-			if (IFS.eof()) return k;
-			k++;
-			if (IFS.get() == newline) return k;
+	//Copy the current record out of a buffer that is about to be reused
+	//The column views are moved to the copy as well so that the parsed record stays usable
+	void keep_currentrecord() {
+		if (RecordView.data() != CurrentRecord.data()) {
+			const uintptr_t oldbase = (uintptr_t)RecordView.data();
+			const uintptr_t oldend = oldbase + RecordView.size();
+			CurrentRecord.assign(RecordView.data(), RecordView.size());
+			RecordView = CurrentRecord;
+			for (std::string_view& v : colviews) {
+				const uintptr_t p = (uintptr_t)v.data();
+				if (p >= oldbase && p + v.size() <= oldend) {
+					v = RecordView.substr((size_t)(p - oldbase), v.size());
+				}
+				else {
+					v = std::string_view();
+				}
+			}
 		}
-		return k;
 	}
 
-	size_t determine_record_length() {
-		rewind();
-		size_t rl = determine_record_length_no_rewind();
-		size_t k = 1;
-		while (k < 100) {
-			size_t n = determine_record_length_no_rewind();
-			if (IFS.eof()) {
-				break;
+	//(Re)start the prefetch thread reading from byte offset of the file with its own file handle
+	void restart_prefetch(const size_t& offset) {
+		Prefetcher->stop();
+		keep_currentrecord();
+		PrefetchPos = 0;
+		PrefetchEof = false;
+		PrefetchBlock.clear();
+		Prefetcher->start(make_reader(offset), PrefetchBlockSize, PrefetchNBlocks);
+		if (Compressed && offset == 0) PassLineIndex.begin();
+	}
+
+	//Skips k records of the prefetched input, returns false if its end is reached first
+	bool skip_prefetched_records(size_t k) {
+		keep_currentrecord();
+		if (k > 0) PassLineIndex.abandon();
+		while (k > 0) {
+			if (PrefetchPos >= PrefetchBlock.size()) {
+				if (Prefetcher->next(PrefetchBlock) == false) {
+					PrefetchEof = true;
+					return false;
+				}
+				PrefetchPos = 0;
 			}
-			else {
-				if (n != rl) {
-					std::string msg = _SRC_;
-					msg += strprint("\n%s is not a fixed record length\n", FileName.c_str());
-					msg += strprint("\trecord 1 has length %zu\n", rl);
-					msg += strprint("\trecord %zu has length %zu\n", k + 1, n);
-					throw(std::runtime_error(msg));
+			const char* p = PrefetchBlock.data() + PrefetchPos;
+			const char* end = PrefetchBlock.data() + PrefetchBlock.size();
+			while (k > 0 && p < end) {
+				const char* nl = findchar(p, end, newline);
+				p = (nl == end) ? end : nl + 1;
+				k--;
+			}
+			PrefetchPos = (size_t)(p - PrefetchBlock.data());
+		}
+		return true;
+	}
+
+	//Compressed input has no random access, so going back means inflating again from the start and skipping to record n
+	bool goto_compressed_record(const size_t& n, const bool restart) {
+		if (restart || n < NextRecord) {
+			if (n > 0 && SeekWarned == false) {
+				glog.warningmsg(_SRC_, "Random access (goto_record) is not available for compressed file %s, it is emulated by rewinding and skipping records\n", FileName.c_str());
+				SeekWarned = true;
+			}
+			restart_prefetch(0);
+			NextRecord = 0;
+		}
+		const bool status = skip_prefetched_records(n - NextRecord);
+		NextRecord = n;
+		return status;
+	}
+
+	bool load_next_prefetched_record() {
+		while (PrefetchPos >= PrefetchBlock.size()) {
+			if (Prefetcher->next(PrefetchBlock) == false) {
+				PrefetchEof = true;
+				if (Compressed) {
+					NRecordsCounted = NextRecord - 1;
+					PassLineIndex.finish();
 				}
-				k++;
+				CurrentRecord.clear();
+				RecordView = std::string_view();
+				return false;
 			}
+			PrefetchPos = 0;
+		}
+		const char* p = PrefetchBlock.data() + PrefetchPos;
+		const size_t remaining = PrefetchBlock.size() - PrefetchPos;
+		const char* nl = (const char*)std::memchr(p, newline, remaining);
+		const size_t len = nl ? (size_t)(nl - p) : remaining;
+		RecordView = std::string_view(p, len);
+		PrefetchPos += nl ? len + 1 : len;
+		if (Compressed) add_to_pass_line_index(RecordView);
+		return true;
+	}
+
+	//Invalidate state derived from the field definitions
+	void fields_changed() {
+		columnslices_valid = false;
+		PassLineIndex.invalidate();
+		GroupBatch = cColumnarBatch();
+	}
+
+	//Length of the record starting at byte pos of [data, data + size), pos is advanced to the next record
+	static size_t buffer_record_length(const char* data, const size_t size, size_t& pos, bool& hitend) {
+		const size_t start = pos;
+		const char* nl = findchar(data + pos, data + size, newline);
+		if (nl == data + size) {
+			hitend = true;
+			pos = size;
+			return pos - start + 1;
+		}
+		hitend = false;
+		pos = (size_t)(nl - data) + 1;
+		return pos - start;
+	}
+
+	//Length of the first record after checking that the first (up to) 100 records in [data, data + size) have the same length
+	//Delimited files may have variable length records, for which VariableLength is set and the first record's length returned
+	size_t determine_record_length(const char* data, const size_t size) {
+		size_t pos = 0;
+		bool hitend = false;
+		if (size == 0) return 0;
+		size_t rl = buffer_record_length(data, size, pos, hitend);
+		size_t k = 1;
+		while (k < 100 && hitend == false && pos < size) {
+			size_t n = buffer_record_length(data, size, pos, hitend);
+			if (hitend) break;
+			if (n != rl) {
+				if (parsetype == ParseType::DELIMITED) {
+					VariableLength = true;
+					return rl;
+				}
+				std::string msg = _SRC_;
+				msg += strprint("\n%s is not a fixed record length\n", FileName.c_str());
+				msg += strprint("\trecord 1 has length %zu\n", rl);
+				msg += strprint("\trecord %zu has length %zu\n", k + 1, n);
+				throw(std::runtime_error(msg));
+			}
+			k++;
 		}
 		return rl;
 	}
 
+	bool load_next_mapped_record() {
+		if (MapPos >= MMF.size()) {
+			MapEof = true;
+			RecordView = std::string_view();
+			return false;
+		}
+		const char* p = MMF.data() + MapPos;
+		const size_t remaining = MMF.size() - MapPos;
+		const char* nl = (const char*)std::memchr(p, newline, remaining);
+		if (nl == nullptr) {
+			//Last record with no trailing newline
+			RecordView = std::string_view(p, remaining);
+			MapPos = MMF.size();
+			MapEof = true;
+		}
+		else {
+			RecordView = std::string_view(p, (size_t)(nl - p));
+			MapPos += RecordView.size() + 1;
+		}
+		return true;
+	}
+
+	static bool starts_with_ci(const std::string_view s, const char* prefix) {
+		const size_t n = std::strlen(prefix);
+		if (s.size() < n) return false;
+		for (size_t i = 0; i < n; i++) {
+			if (std::tolower((unsigned char)s[i]) != std::tolower((unsigned char)prefix[i])) return false;
+		}
+		return true;
+	}
+
+	size_t determine_record_length() {
+		if (readmode == ReadMode::MMAP) {
+			return determine_record_length(MMF.data(), MMF.size());
+		}
+		//Read blocks until the first 100 records are in the buffer
+		const size_t blocksize = 65536;
+		std::vector<char> buf;
+		size_t nnewlines = 0;
+		cBlockPrefetcher::ReadFunc read = make_reader(0);
+		while (nnewlines < 100) {
+			const size_t n0 = buf.size();
+			buf.resize(n0 + blocksize);
+			const size_t nread = read(buf.data() + n0, blocksize);
+			buf.resize(n0 + nread);
+			if (nread == 0) break;
+			nnewlines += countchar(buf.data() + n0, buf.data() + buf.size(), newline);
+		}
+		return determine_record_length(buf.data(), buf.size());
+	}
+
 public:
 	enum class HeaderType { DFN, CSV, HDR, NONE } headertype = HeaderType::NONE;
 	enum class ParseType { FIXEDWIDTH, DELIMITED } parsetype = ParseType::FIXEDWIDTH;
 
 	const std::vector<std::string>& cref_colstrings() const
 	{
+		if (colstrings_current == false) {
+			ensure_all_columns_parsed();
+			colstrings.resize(colviews.size());
+			for (size_t i = 0; i < colviews.size(); i++) {
+				colstrings[i].assign(colviews[i].data(), colviews[i].size());
+			}
+			colstrings_current = true;
+		}
 		return colstrings;
 	};
 
+	const std::vector<std::string_view>& cref_colviews() const
+	{
+		ensure_all_columns_parsed();
+		return colviews;
+	};
+
 	std::vector<cAsciiColumnField> fields;
 
 	cAsciiColumnFile() {};
 
-	cAsciiColumnFile(const std::string& filename) {
-		openfile(filename);
+	cAsciiColumnFile(const std::string& filename, const ReadMode mode = ReadMode::STREAM) {
+		openfile(filename, mode);
 	};
 
-	const std::string& currentrecord_string() const { return CurrentRecord; };
+	//Delimited files may have variable length records
+	cAsciiColumnFile(const std::string& filename, const ParseType ptype, const ReadMode mode = ReadMode::STREAM) {
+		parsetype = ptype;
+		openfile(filename, mode);
+	};
 
-	const std::vector<std::string>& currentrecord_columns() const { return colstrings; };
+	const std::string& currentrecord_string() const {
+		if (RecordView.data() != CurrentRecord.data()) {
+			//Only materialised on request, the reading and parsing use the view
+			CurrentRecord.assign(RecordView.data(), RecordView.size());
+		}
+		return CurrentRecord;
+	};
+
+	std::string_view currentrecord_view() const { return RecordView; };
+
+	const std::vector<std::string>& currentrecord_columns() const { return cref_colstrings(); };
+
+	void clear_currentrecord() {
+		CurrentRecord.clear();
+		RecordView = std::string_view();
+	};
+
+	ReadMode read_mode() const { return readmode; };
+
+	//Opt-in background reading for STREAM mode: a thread reads ahead into at most nblocks blocks totalling about memorybudget bytes,
+	//so that reading the next records or group overlaps with the processing of the current ones.
+	//goto_record(), load_record() and rewind() restart the thread at the new position, so it is only worthwhile for sequential reading.
+	//MMAP mode already relies on the kernel's read-ahead of the sequentially advised mapping, so this does nothing there.
+	//Compressed files are always read this way (openfile enables it), so the thread also does the inflating.
+	bool enable_prefetch(const size_t memorybudget = 64 * 1024 * 1024, const size_t nblocks = 2) {
+		if (readmode != ReadMode::STREAM || (RecordLength == 0 && Compressed == false)) return false;
+		PrefetchNBlocks = std::max((size_t)2, nblocks);
+		PrefetchBlockSize = std::max(memorybudget / PrefetchNBlocks, 2 * RecordLength);
+		if (!Prefetcher) Prefetcher = std::make_unique<cBlockPrefetcher>();
+		if (Compressed) {
+			return goto_compressed_record(NextRecord, true);
+		}
+		//Continue from the current position, which the stream may not be at if a record is up the spout
+		restart_prefetch(record_offset(NextRecord));
+		return true;
+	};
 
-	void clear_currentrecord() { CurrentRecord.clear(); };
+	//Has no effect on compressed files, which can only be read by the prefetch thread
+	void disable_prefetch() {
+		if (!Prefetcher || Compressed) return;
+		Prefetcher.reset();
+		keep_currentrecord();
+		PrefetchBlock = std::vector<char>();
+		const size_t n = NextRecord;
+		goto_record(n);
+	};
+
+	bool isprefetching() const { return (bool)Prefetcher; };
+
+	//True if the file is gzip compressed (detected by openfile), it is then read sequentially and goto_record() has to rewind and skip
+	bool iscompressed() const { return Compressed; };
+
+	//For a compressed file the line index of field_index is then built during the next sequential pass from the first record to the end
+	//(eg readnextgroup over the whole file, or the count done by nrecords()), after which scan_for_line_index() needs no pass of its own
+	void set_line_index_field(const int& field_index) {
+		PassLineIndex.setfield(field_index);
+	};
+
+	bool eof() const {
+		if (RangeEof) return true;
+		if (readmode == ReadMode::MMAP) return MapEof;
+		if (Prefetcher) return PrefetchEof;
+		return IFS.eof();
+	}
+
+	//Restrict reading to the records [first, first+count), rewind() then goes to first and load_next_record() stops after the last.
+	//Record numbers (goto_record, load_record, scan_for_line_index) remain absolute.
+	bool set_record_range(const size_t& first, const size_t& count) {
+		RangeFirst = first;
+		RangeEnd = first + count;
+		return goto_record(first);
+	}
+
+	void clear_record_range() {
+		RangeFirst = 0;
+		RangeEnd = undefinedvalue<size_t>();
+		RangeEof = false;
+	}
+
+	bool has_record_range() const {
+		return RangeEnd != undefinedvalue<size_t>();
+	}
+
+	size_t range_first_record() const { return RangeFirst; };
+
+	size_t range_nrecords() {
+		if (has_record_range()) return RangeEnd - RangeFirst;
+		return nrecords();
+	}
+
+	//Record bounds (nparts+1 of them) splitting nrecords into nparts contiguous blocks of near equal size
+	static std::vector<size_t> partition_records(const size_t& nrecords, const size_t& nparts) {
+		std::vector<size_t> bounds(nparts + 1);
+		for (size_t k = 0; k <= nparts; k++) {
+			bounds[k] = (k * nrecords) / nparts;
+		}
+		return bounds;
+	}
+
+	//As partition_records but every bound is moved to the nearest start of a line so that no line is split between parts
+	static std::vector<size_t> partition_lines(const std::vector<unsigned int>& line_index_start, const std::vector<unsigned int>& line_index_count, const size_t& nparts) {
+		std::vector<size_t> lb(line_index_start.begin(), line_index_start.end());
+		const size_t last = lb.size() > 0 ? (size_t)line_index_start.back() + line_index_count.back() : 0;
+		lb.push_back(last);
+		const size_t first = lb[0];
+
+		std::vector<size_t> bounds = partition_records(last - first, nparts);
+		for (size_t k = 0; k <= nparts; k++) {
+			const size_t target = first + bounds[k];
+			auto it = std::lower_bound(lb.begin(), lb.end(), target);
+			size_t b = (it == lb.end()) ? last : *it;
+			if (it != lb.begin() && it != lb.end()) {
+				const size_t a = *(it - 1);
+				if (target - a < b - target) b = a;
+			}
+			if (k > 0 && b < bounds[k - 1]) b = bounds[k - 1];
+			bounds[k] = b;
+		}
+		bounds[0] = first;
+		bounds[nparts] = last;
+		return bounds;
+	}
 
 	void set_record_length(const size_t& length) {
 		RecordLength = length;
@@ -113,69 +720,314 @@ public:
 		return FileSize;
 	}
 
+	//For a compressed file this needs a pass to count the records unless one has already reached the end (eg a sequential read or
+	//scan_for_line_index), that pass also builds the line index if a line index field is set
 	size_t nrecords() {
+		if (Compressed) {
+			if (NRecordsCounted == undefinedvalue<size_t>()) NRecordsCounted = count_compressed_records();
+			return NRecordsCounted;
+		}
+		if (VariableLength && OffsetStride == 0) build_record_offset_index();
+		if (OffsetStride > 0) return NRecordsIndexed;
+		if (RecordLength == 0) return 0;
 		return (size_t)std::ceil((double)FileSize / (double)RecordLength);
 	}
 
-	size_t nrecords_manual_count() {
-		rewind();
+	bool is_variable_length() const { return VariableLength; };
+
+	bool has_record_offset_index() const { return OffsetStride > 0; };
+
+	//Builds the sparse index of the byte offset of every stride'th record in one (SIMD newline finding) pass of the file.
+	//It is built automatically for variable length records, for which it makes goto_record() and the parallel chunking possible.
+	void build_record_offset_index(const size_t stride = 1024) {
+		if (Compressed) {
+			glog.warningmsg(_SRC_, "A record offset index is not available for compressed file %s\n", FileName.c_str());
+			return;
+		}
+		RecordOffsets.clear();
+		OffsetStride = std::max((size_t)1, stride);
 		size_t nr = 0;
-		std::streamsize gc = 0;
-		while (IFS.ignore(RecordLength, newline)) {
+		auto startrecord = [&](const size_t offset) {
+			if (nr % OffsetStride == 0) RecordOffsets.push_back(offset);
 			nr++;
-			gc = IFS.gcount();
+		};
+		if (FileSize > 0) startrecord(0);
+
+		auto scan = [&](const char* data, const size_t size, const size_t base) {
+			const char* end = data + size;
+			const char* p = data;
+			while ((p = findchar(p, end, newline)) != end) {
+				const size_t next = base + (size_t)(p - data) + 1;
+				if (next < FileSize) startrecord(next);
+				p++;
+			}
+		};
+
+		if (readmode == ReadMode::MMAP) {
+			scan(MMF.data(), MMF.size(), 0);
 		}
-		if (gc == 0) nr--;//In case of blank last line (newline after last line)
-		IFS.clear();
+		else {
+			std::ifstream ifs(FileName, std::ifstream::in | std::ifstream::binary);
+			if (!ifs) {
+				glog.errormsg(_SRC_, "Could not open file %s to build the record offset index\n", FileName.c_str());
+			}
+			const size_t blocksize = 4194304;
+			std::vector<char> buf(blocksize);
+			size_t base = 0;
+			while (true) {
+				ifs.read(buf.data(), (std::streamsize)blocksize);
+				const size_t nread = (size_t)ifs.gcount();
+				if (nread == 0) break;
+				scan(buf.data(), nread, base);
+				base += nread;
+			}
+		}
+		NRecordsIndexed = nr;
+	}
+
+	//Byte offset of the start of record n, FileSize if n is beyond the last record
+	size_t record_offset(const size_t& n) {
+		if (OffsetStride == 0) {
+			if (VariableLength == false) return std::min(n * RecordLength, FileSize);
+			build_record_offset_index();
+		}
+		if (n >= NRecordsIndexed) return FileSize;
+		const size_t off = RecordOffsets[n / OffsetStride];
+		size_t nskip = n % OffsetStride;
+		if (nskip == 0) return off;
+
+		if (readmode == ReadMode::MMAP) {
+			const char* p = MMF.data() + off;
+			while (nskip-- > 0) p = findchar(p, MMF.end(), newline) + 1;
+			return (size_t)(p - MMF.data());
+		}
+
+		//Its own stream so that the reading position is not disturbed, opened once and reused
+		if (OffsetIFS.is_open() == false) {
+			OffsetIFS.open(FileName, std::ifstream::in | std::ifstream::binary);
+			if (!OffsetIFS) {
+				glog.errormsg(_SRC_, "Could not open file %s\n", FileName.c_str());
+			}
+		}
+		OffsetIFS.clear();
+		OffsetIFS.seekg((std::streamoff)off, std::ios::beg);
+		std::vector<char>& buf = OffsetBuffer;
+		buf.resize(std::max((size_t)65536, RecordLength * 64));
+		size_t base = off;
+		while (true) {
+			OffsetIFS.read(buf.data(), (std::streamsize)buf.size());
+			const size_t nread = (size_t)OffsetIFS.gcount();
+			if (nread == 0) return FileSize;
+			const char* end = buf.data() + nread;
+			const char* p = buf.data();
+			while ((p = findchar(p, end, newline)) != end) {
+				p++;
+				if (--nskip == 0) return base + (size_t)(p - buf.data());
+			}
+			base += nread;
+		}
+	}
+
+	//Sidecar file in which load_or_build_record_offset_index() caches the record offset index
+	std::string record_offset_index_cache_path() const {
+		return FileName + ".offsetindex";
+	};
+
+	//Loads the record offset index from the sidecar cache if it is up to date, otherwise builds it and rewrites the cache.
+	//Returns true if the cache was used.
+	bool load_or_build_record_offset_index(const size_t stride = 1024, std::string cachepath = std::string()) {
+		if (Compressed) {
+			build_record_offset_index(stride);
+			return false;
+		}
+		if (cachepath.empty()) cachepath = record_offset_index_cache_path();
+		const std::string key = datafile_cache_key() + strprint("stride %zu\n", stride);
+
+		std::ifstream ifs(cachepath);
+		if (ifs) {
+			std::string line, filekey;
+			bool valid = (std::getline(ifs, line) && line == "ASCIICOLUMNFILE_OFFSETINDEX 1");
+			const size_t nkeylines = (size_t)std::count(key.begin(), key.end(), '\n');
+			for (size_t k = 0; valid && k < nkeylines; k++) {
+				valid = (bool)std::getline(ifs, line);
+				filekey += line + "\n";
+			}
+			std::string token1, token2;
+			size_t nr = 0, noffsets = 0;
+			if (valid && filekey == key && (ifs >> token1 >> nr >> token2 >> noffsets) && token1 == "nrecords" && token2 == "noffsets") {
+				std::vector<size_t> offsets(noffsets);
+				for (size_t i = 0; valid && i < noffsets; i++) {
+					valid = (bool)(ifs >> offsets[i]);
+				}
+				if (valid) {
+					OffsetStride = stride;
+					NRecordsIndexed = nr;
+					RecordOffsets = std::move(offsets);
+					return true;
+				}
+			}
+		}
+		ifs.close();
+
+		build_record_offset_index(stride);
+
+		bool writer = true;
+#ifdef ENABLE_MPI
+		writer = (cMpiEnv::world_rank() == 0);
+#endif
+		if (writer) {
+			const bool status = write_sidecar_atomically(cachepath, [&](std::ofstream& ofs) {
+				ofs << "ASCIICOLUMNFILE_OFFSETINDEX 1\n";
+				ofs << key;
+				ofs << "nrecords " << NRecordsIndexed << "\n";
+				ofs << "noffsets " << RecordOffsets.size() << "\n";
+				for (size_t i = 0; i < RecordOffsets.size(); i++) ofs << RecordOffsets[i] << "\n";
+			});
+			if (status == false) {
+				glog.warningmsg(_SRC_, "Unable to write record offset index cache file %s\n", cachepath.c_str());
+			}
+		}
+		return false;
+	}
+
+	//Counts the newlines, plus one if the last record has no trailing newline
+	size_t nrecords_manual_count() {
+		if (readmode == ReadMode::MMAP) {
+			if (MMF.size() == 0) return 0;
+			size_t nr = countchar(MMF.data(), MMF.end(), newline);
+			if (MMF.end()[-1] != newline) nr++;
+			return nr;
+		}
+
+		const size_t nr = count_records();
 		rewind();
 		return nr;
 	}
 
 	bool goto_record(const size_t& n) {
-		std::streamoff p = n * RecordLength;
+		RangeEof = false;
+		if (Compressed) {
+			return goto_compressed_record(n, false);
+		}
+		NextRecord = n;
+		size_t p = n * RecordLength;
+		bool valid = (p <= FileSize);
+		if (VariableLength || OffsetStride > 0) {
+			valid = (n <= nrecords());
+			p = record_offset(n);
+		}
+		if (readmode == ReadMode::MMAP) {
+			MapEof = false;
+			if (valid == false) return false;
+			MapPos = p;
+			return true;
+		}
+		if (Prefetcher) {
+			restart_prefetch(p);
+			return valid;
+		}
 		IFS.clear();
-		if (IFS.seekg(p, IFS.beg))return true;
+		if (IFS.seekg((std::streamoff)p, IFS.beg))return true;
 		return false;
 	}
 
 	bool load_next_record() {
-		if (std::getline(IFS, CurrentRecord)) {
-			return true;
+		clear_columns();
+		if (NextRecord >= RangeEnd) {
+			RangeEof = true;
+			CurrentRecord.clear();
+			RecordView = std::string_view();
+			return false;
 		}
-		return false;
+		NextRecord++;
+		if (readmode == ReadMode::MMAP) {
+			return load_next_mapped_record();
+		}
+		if (Prefetcher) {
+			return load_next_prefetched_record();
+		}
+		bool status = (bool)std::getline(IFS, CurrentRecord);
+		RecordView = CurrentRecord;
+		return status;
 	}
 
 	bool load_record(const size_t& n) {
 		if (goto_record(n)) {
-			if (std::getline(IFS, CurrentRecord)) {
-				return true;
-			}
+			return load_next_record();
 		}
 		return false;
 	}
 
 	std::string get_next_record() {
 		load_next_record();
-		return CurrentRecord;
+		return std::string(RecordView);
 	}
 
 	std::string get_record(size_t n) {
 		load_record(n);
-		return CurrentRecord;
+		return std::string(RecordView);
 	}
 
 	void rewind() {
+		if (RangeFirst > 0) {
+			goto_record(RangeFirst);
+			return;
+		}
+		NextRecord = 0;
+		RangeEof = false;
+		if (readmode == ReadMode::MMAP) {
+			MapPos = 0;
+			MapEof = false;
+			return;
+		}
+		if (Prefetcher) {
+			restart_prefetch(0);
+			return;
+		}
 		IFS.clear();
 		IFS.seekg(0);
 	}
 
-	bool openfile(const std::string& datafilename) {
+	//Gzip compressed files (.gz) are detected and inflated on the fly by a background thread (requires ENABLE_ZLIB),
+	//they are read in STREAM mode whatever the mode requested.
+	bool openfile(const std::string& datafilename, const ReadMode mode = ReadMode::STREAM) {
+		Prefetcher.reset();
+		VariableLength = false;
+		OffsetStride = 0;
+		RecordOffsets.clear();
+		NRecordsIndexed = 0;
+		if (OffsetIFS.is_open()) OffsetIFS.close();
+		NRecordsCounted = undefinedvalue<size_t>();
+		SeekWarned = false;
+		PassLineIndex = cPassLineIndex();
+		NextRecord = 0;
 		FileName = datafilename;
 		fixseparator(FileName);
-		//Open in binary mode so \r\n does not get converted to \n
-		IFS.open(datafilename, std::ifstream::in | std::ifstream::binary);
-		if (!IFS) {
-			glog.errormsg(_SRC_, "Could not open file %s\n", FileName.c_str());
+		readmode = mode;
+		Compressed = is_gzip_file(FileName);
+		if (Compressed) {
+#ifndef ENABLE_ZLIB
+			glog.errormsg(_SRC_, "%s is gzip compressed but zlib support was not compiled in (ENABLE_ZLIB)\n", FileName.c_str());
+#endif
+			if (readmode == ReadMode::MMAP) {
+				glog.warningmsg(_SRC_, "%s is gzip compressed so it will be read in STREAM mode rather than MMAP mode\n", FileName.c_str());
+				readmode = ReadMode::STREAM;
+			}
+		}
+		else if (readmode == ReadMode::MMAP) {
+			if (MMF.open(FileName) == false) {
+				glog.errormsg(_SRC_, "Could not memory map file %s\n", FileName.c_str());
+			}
+			MMF.advise_sequential();
+			MapPos = 0;
+			MapEof = false;
+		}
+		else {
+			//Open in binary mode so \r\n does not get converted to \n
+			IFS.open(datafilename, std::ifstream::in | std::ifstream::binary);
+			if (!IFS) {
+				glog.errormsg(_SRC_, "Could not open file %s\n", FileName.c_str());
+			}
 		}
 		FileSize = std::filesystem::file_size(FileName);
 
@@ -186,37 +1038,167 @@ public:
 		}
 		cMpiComm c = cMpiEnv::world_comm();
 		c.bcast(RecordLength);
+		int variablelength = VariableLength ? 1 : 0;
+		c.bcast(variablelength);
+		VariableLength = (variablelength == 1);
 		cMpiEnv::world_barrier();
 #else
 		RecordLength = determine_record_length();
 		rewind();
 #endif		
 
+		//Smaller blocks than the default so that the inflating and the parsing overlap from the start
+		if (Compressed) enable_prefetch(16 * 1024 * 1024, 4);
 		return true;
 	};
 
-	std::vector<cFmt> check_formats(const size_t nrecords = 100) {
+	//Up to nsamples non-blank records (without their line endings) spread across the whole file, the first nhead of them
+	//consecutive from the start and the rest at evenly spaced byte offsets, so only a page or so of the mapping is touched per sample.
+	//Compressed files have no random access and are sampled from the start only.
+	std::vector<std::string> sample_records(const size_t nsamples, const size_t nhead = 100) const {
+		std::vector<std::string> samples;
+		auto add = [&samples](const char* p, const char* end) {
+			std::string_view r(p, (size_t)(end - p));
+			if (r.size() > 0 && r.back() == carriagereturn) r.remove_suffix(1);
+			if (r.find_first_not_of(" \t") != std::string_view::npos) samples.emplace_back(r);
+		};
+
+		if (Compressed) {
+			cRecordReader R(make_reader(0));
+			std::vector<char> buf;
+			R.read_records(nsamples, buf);
+			const char* p = buf.data();
+			const char* end = buf.data() + buf.size();
+			while (p < end) {
+				const char* nl = findchar(p, end, newline);
+				add(p, nl);
+				p = (nl == end) ? end : nl + 1;
+			}
+			return samples;
+		}
 
-		std::string s = get_record(0);
-		std::vector<cFmt> fmts0 = guess_column_formats(s);
+		cMemoryMappedFile local;
+		const cMemoryMappedFile* m = &MMF;
+		if (readmode != ReadMode::MMAP) {
+			if (local.open(FileName) == false) {
+				glog.errormsg(_SRC_, "Could not memory map file %s\n", FileName.c_str());
+			}
+			m = &local;
+		}
+		const char* p = m->data();
+		const char* end = m->end();
+		while (p < end && samples.size() < std::min(nhead, nsamples)) {
+			const char* nl = findchar(p, end, newline);
+			add(p, nl);
+			p = (nl == end) ? end : nl + 1;
+		}
 
-		int k = 1;
-		while (k < nrecords) {
-			if (IFS.eof()) break;
-			s = get_record(k);
-			if (s.size() == 0)continue;
+		const size_t nspread = nsamples - samples.size();
+		const size_t span = (size_t)(end - p);
+		for (size_t i = 0; i < nspread && p < end; i++) {
+			//Start of the first record at or after the offset
+			const char* q = p + (size_t)((double)span * (double)i / (double)nspread);
+			if (q > p) {
+				q = findchar(q - 1, end, newline);
+				if (q == end) break;
+				q++;
+			}
+			if (q >= end) break;
+			add(q, findchar(q, end, newline));
+		}
+		return samples;
+	}
 
-			std::vector<cFmt> fmts1 = guess_column_formats(s);
-			if (fmts0 != fmts1) {
-				std::string msg = _SRC_;
-				msg += strprint("\nIn file %s\n", FileName.c_str());
-				msg += strprint("\tField formats on record %d do not match those on record 1\n", k + 1);
-				throw(std::runtime_error(msg));
+	//Formats of the fixed width fields of records, each field ending where a column occupied (non-blank) in any record
+	//is followed by one that is blank in all records. A field is 'A' if any of its values is not a number, 'E' if any has
+	//an exponent, 'F' if any has a decimal point and otherwise 'I', with the most decimals seen.
+	//Warns about fields in which a record has more than one value, as the occupancy of other records has merged them.
+	static std::vector<cFmt> infer_column_formats(const std::vector<std::string>& records) {
+		size_t maxlen = 0;
+		for (const std::string& r : records) maxlen = std::max(maxlen, r.size());
+
+		std::vector<uint8_t> occupied(maxlen + 1, 0);
+		for (const std::string& r : records) {
+			//Branch free so that the compiler vectorises it
+			uint8_t* o = occupied.data();
+			const char* c = r.data();
+			const size_t n = r.size();
+			for (size_t i = 0; i < n; i++) {
+				o[i] |= (uint8_t)((c[i] != ' ') & (c[i] != '\t'));
 			}
-			k++;
 		}
-		rewind();
-		return fmts0;
+
+		std::vector<size_t> breaks;
+		for (size_t i = 1; i <= maxlen; i++) {
+			if (occupied[i - 1] && occupied[i] == 0) breaks.push_back(i);
+		}
+
+		//A record with more than one blank separated value inside an inferred field means the masks of other records
+		//have filled the gap between two of its fields, so those fields have been merged
+		std::vector<bool> merged(breaks.size(), false);
+		for (const std::string& r : records) {
+			size_t start = 0;
+			for (size_t k = 0; k < breaks.size() && start < r.size(); k++) {
+				const std::string_view f = trim_view(std::string_view(r).substr(start, breaks[k] - start));
+				if (f.find_first_of(" \t") != std::string_view::npos) merged[k] = true;
+				start = breaks[k];
+			}
+		}
+
+		std::vector<cFmt> fmts;
+		size_t start = 0;
+		for (size_t k = 0; k < breaks.size(); k++) {
+			fmts.push_back(infer_field_format(records, start, breaks[k]));
+			if (merged[k]) {
+				glog.warningmsg(_SRC_, "Inferred field %zu (characters %zu to %zu) holds more than one blank separated value in some records, it may be several fields merged\n", k + 1, start + 1, breaks[k]);
+			}
+			start = breaks[k];
+		}
+		return fmts;
+	}
+
+	//Format of the field occupying characters [start, end) of records
+	static cFmt infer_field_format(const std::vector<std::string>& records, const size_t start, const size_t end) {
+		bool ischar = false;
+		bool hasexponent = false;
+		bool haspoint = false;
+		size_t edecimals = 0;
+		size_t fdecimals = 0;
+		for (const std::string& r : records) {
+			if (r.size() <= start) continue;
+			const std::string_view f = trim_view(std::string_view(r).substr(start, end - start));
+			if (f.size() == 0) continue;
+			if (f.find_first_not_of("0123456789+-.eEdD") != std::string_view::npos || isnumeric_string(f) == false) {
+				ischar = true;
+				break;
+			}
+			const size_t p = f.find('.');
+			const size_t e = f.find_first_of("eEdD");
+			if (e != std::string_view::npos) {
+				hasexponent = true;
+				if (p != std::string_view::npos && p < e) edecimals = std::max(edecimals, e - p - 1);
+			}
+			else if (p != std::string_view::npos) {
+				haspoint = true;
+				fdecimals = std::max(fdecimals, f.size() - p - 1);
+			}
+		}
+		if (ischar) return cFmt('A', end - start, 0);
+		if (hasexponent) return cFmt('E', end - start, edecimals);
+		if (haspoint) return cFmt('F', end - start, fdecimals);
+		return cFmt('I', end - start, 0);
+	}
+
+	//Infers the field formats from records sampled across the whole file, the read position is not disturbed
+	std::vector<cFmt> check_formats(const size_t nsamples = 1000) {
+		const std::vector<std::string> samples = sample_records(nsamples);
+		if (samples.size() == 0) {
+			std::string msg = _SRC_;
+			msg += strprint("\nIn file %s\n", FileName.c_str());
+			msg += strprint("\tThere are no non-blank records from which to infer the field formats\n");
+			throw(std::runtime_error(msg));
+		}
+		return infer_column_formats(samples);
 	}
 
 	static std::vector<std::string> tokenise(const std::string& str, const char delim) {
@@ -307,11 +1289,12 @@ public:
 			k += c.nbands;
 			startchar += c.nbands * c.width;
 		}
+		fields_changed();
 		return true;
 	};
 
 	bool set_fields_noheader() {
-		std::vector<cFmt> fmts = check_formats(100);
+		std::vector<cFmt> fmts = check_formats();
 		size_t startchar = 0;
 		for (size_t i = 0; i < fmts.size(); i++) {
 			std::string name = strprint("Column %d", i + 1);
@@ -321,13 +1304,14 @@ public:
 			fields.push_back(f);
 			startchar += f.width * f.nbands;
 		}
+		fields_changed();
 		return true;
 	};
 
 	bool parse_hdr_header(const std::string& hdrpath) {
 		cHDRHeader H(hdrpath);
 		fields = H.getfields();
-		std::vector<cFmt> fmts = check_formats(100);
+		std::vector<cFmt> fmts = check_formats();
 		set_hdr_formats(fmts);
 		return true;
 	};
@@ -381,6 +1365,7 @@ public:
 			fields[i].startcolumn = startcolumn;
 			startcolumn += fields[i].nbands;
 		}
+		fields_changed();
 		return true;
 	};
 
@@ -389,19 +1374,100 @@ public:
 		fields = H.getfields();
 		ST_string = H.get_ST_string();
 		RT_string = H.get_RT_string();
+		fields_changed();
+	}
+
+	//Lookup table of the characters "0123456789.+-eE ,\t\r\n" that may appear in a numeric record
+	static const std::array<bool, 256>& numeric_record_characters() {
+		static const std::array<bool, 256> table = [] {
+			std::array<bool, 256> t{};
+			for (const char c : std::string_view("0123456789.+-eE ,\t\r\n")) t[(unsigned char)c] = true;
+			return t;
+		}();
+		return table;
+	}
+
+	//Position of the first character at or after startpos that cannot appear in a numeric record, or npos if there is none.
+	//The valid characters are '+' to '9' except '/', e, E, space, tab, \r and \n, which are tested 32 (AVX2) or 16 (SSE2) at a time.
+	static size_t first_non_numeric_character(const std::string_view str, const size_t startpos)
+	{
+		if (startpos >= str.size()) return std::string_view::npos;
+		const char* const begin = str.data();
+		const char* const end = begin + str.size();
+		const char* p = begin + startpos;
+
+#if defined __AVX2__
+		{
+			const __m256i lo = _mm256_set1_epi8('+' - 1);
+			const __m256i hi = _mm256_set1_epi8('9' + 1);
+			const __m256i slash = _mm256_set1_epi8('/');
+			const __m256i lowercase = _mm256_set1_epi8(0x20);
+			const __m256i e = _mm256_set1_epi8('e');
+			const __m256i space = _mm256_set1_epi8(' ');
+			const __m256i tab = _mm256_set1_epi8('\t');
+			const __m256i lf = _mm256_set1_epi8('\n');
+			const __m256i cr = _mm256_set1_epi8('\r');
+			while (end - p >= 32) {
+				const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+				__m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+				ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, slash), ok);
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(_mm256_or_si256(v, lowercase), e));
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, space));
+				ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, lf)));
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, cr));
+				const uint32_t bad = ~(uint32_t)_mm256_movemask_epi8(ok);
+				if (bad) return (size_t)(p - begin) + lowestsetbit32(bad);
+				p += 32;
+			}
+		}
+#endif
+#if defined _file_utils_SSE2
+		{
+			const __m128i lo = _mm_set1_epi8('+' - 1);
+			const __m128i hi = _mm_set1_epi8('9' + 1);
+			const __m128i slash = _mm_set1_epi8('/');
+			const __m128i lowercase = _mm_set1_epi8(0x20);
+			const __m128i e = _mm_set1_epi8('e');
+			const __m128i space = _mm_set1_epi8(' ');
+			const __m128i tab = _mm_set1_epi8('\t');
+			const __m128i lf = _mm_set1_epi8('\n');
+			const __m128i cr = _mm_set1_epi8('\r');
+			while (end - p >= 16) {
+				const __m128i v = _mm_loadu_si128((const __m128i*)p);
+				__m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmpgt_epi8(hi, v));
+				ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, slash), ok);
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(_mm_or_si128(v, lowercase), e));
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, space));
+				ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, lf)));
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, cr));
+				const uint32_t bad = (~(uint32_t)_mm_movemask_epi8(ok)) & 0xFFFF;
+				if (bad) return (size_t)(p - begin) + lowestsetbit32(bad);
+				p += 16;
+			}
+		}
+#endif
+		const std::array<bool, 256>& valid = numeric_record_characters();
+		for (; p < end; p++) {
+			if (valid[(unsigned char)*p] == false) return (size_t)(p - begin);
+		}
+		return std::string_view::npos;
 	}
 
-	bool contains_non_numeric_characters(const std::string& str, size_t startpos)
+	bool contains_non_numeric_characters(const std::string_view str, size_t startpos)
 	{
-		const static std::string validchars = "0123456789.+-eE ,\t\r\n";
-		size_t pos = str.find_first_not_of(validchars, startpos);
-		if (pos == std::string::npos) return false;
-		else return true;
+		return first_non_numeric_character(str, startpos) != std::string_view::npos;
 	}
 
 	bool is_record_valid() {
+		size_t badpos;
+		return is_record_valid(badpos);
+	}
+
+	//As is_record_valid() but badpos is set to the position of the first non-numeric character (npos if there is none)
+	bool is_record_valid(size_t& badpos) {
 
-		if (CurrentRecord.size() == 0) return false;
+		badpos = std::string_view::npos;
+		if (RecordView.size() == 0) return false;
 
 		size_t startpos = 0;
 		if (headertype == cAsciiColumnFile::HeaderType::DFN) {
@@ -413,15 +1479,15 @@ public:
 				else {
 					if (charpositions_adjusted == false) {
 						//Check if record starts with DATA or COMM that is not declared as a field in the DFN and adjust character positions accordingly
-						if (strncasecmp(CurrentRecord.c_str(), "DATA", 4) == 0) {
-							glog.logmsg(0, "\nDetected DATA at start of record that is not specified in the DFN file as a column. Adjusting character positions accordingly\n%s\n", CurrentRecord.c_str());
-							RT_string = CurrentRecord.substr(0, 4);
+						if (starts_with_ci(RecordView, "DATA")) {
+							glog.logmsg(0, "\nDetected DATA at start of record that is not specified in the DFN file as a column. Adjusting character positions accordingly\n%.*s\n", (int)RecordView.size(), RecordView.data());
+							RT_string = std::string(RecordView.substr(0, 4));
 							adjust_character_positions(RT_string.size());
 							startpos = RT_string.size();
 						}
-						else if (strncasecmp(CurrentRecord.c_str(), "COMM", 4) == 0) {
-							glog.logmsg(0, "\nDetected COMM at start of record that is not specified in the DFN file as a column. Adjusting character positions accordingly\n%s\n", CurrentRecord.c_str());
-							RT_string = CurrentRecord.substr(0, 4);
+						else if (starts_with_ci(RecordView, "COMM")) {
+							glog.logmsg(0, "\nDetected COMM at start of record that is not specified in the DFN file as a column. Adjusting character positions accordingly\n%.*s\n", (int)RecordView.size(), RecordView.data());
+							RT_string = std::string(RecordView.substr(0, 4));
 							adjust_character_positions(RT_string.size());
 							startpos = RT_string.size();
 						}
@@ -429,11 +1495,11 @@ public:
 				}
 			}
 			size_t reclen = fields.back().endchar();
-			if (CurrentRecord.size() < reclen) return false;
+			if (RecordView.size() < reclen) return false;
 		}
 
-		bool nonnumeric = contains_non_numeric_characters(CurrentRecord, startpos);
-		if (nonnumeric) return false;
+		badpos = first_non_numeric_character(RecordView, startpos);
+		if (badpos != std::string_view::npos) return false;
 		else return true;
 	}
 
@@ -442,6 +1508,7 @@ public:
 			fields[i].startchar += offset;
 		}
 		charpositions_adjusted = true;
+		fields_changed();
 	}
 
 	int fieldindexbyname(const std::string& fieldname) const
@@ -454,42 +1521,193 @@ public:
 
 	bool skiprecords(const size_t& nskip) {
 		for (size_t i = 0; i < nskip; i++) {
-			if (IFS.eof()) return false;
-			std::getline(IFS, CurrentRecord);
+			if (eof()) return false;
+			load_next_record();
 		}
 		return true;
 	}
 
-	std::vector<std::string> delimited_parse() {
-		std::vector<std::string> cs;
-		cs = fieldparsestring(CurrentRecord.c_str(), " ,\t\r\n");
-		return cs;
+	//Parse only these zero based columns in parse_record(), any other column is parsed on demand when it is accessed
+	void set_needed_columns(std::vector<size_t> columns) {
+		std::sort(columns.begin(), columns.end());
+		columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+		NeededColumns = columns;
 	}
 
-	std::vector<std::string> fixed_width_parse() {
-		std::vector<std::string> cs;
+	void set_needed_fields(const std::vector<size_t>& findices) {
+		std::vector<size_t> columns;
+		for (const size_t& fi : findices) {
+			for (size_t bi = 0; bi < fields[fi].nbands; bi++) {
+				columns.push_back(fields[fi].startcol() + bi);
+			}
+		}
+		set_needed_columns(columns);
+	}
+
+	//Needed columns from a set of field definitions, a column number definition needs the rest of the bands of the field it is in
+	void set_needed_fields(const cFDMap& fdmap) {
+		std::vector<size_t> columns;
+		for (const auto& [key, fd] : fdmap) {
+			if (fd.type == cFieldDefinition::TYPE::VARIABLENAME) {
+				int fi = fieldindexbyname(fd.varname);
+				if (fi < 0) continue;
+				for (size_t bi = 0; bi < fields[fi].nbands; bi++) {
+					columns.push_back(fields[fi].startcol() + bi);
+				}
+			}
+			else if (fd.type == cFieldDefinition::TYPE::COLUMNNUMBER) {
+				const size_t c = fd.column - fd.coff;
+				size_t last = c;
+				for (size_t fi = 0; fi < fields.size(); fi++) {
+					if ((int)c >= fields[fi].startcol() && (int)c <= fields[fi].endcol()) last = fields[fi].endcol();
+				}
+				for (size_t k = c; k <= last; k++) columns.push_back(k);
+			}
+		}
+		set_needed_columns(columns);
+	}
+
+	void clear_needed_columns() {
+		NeededColumns.clear();
+	}
+
+	const std::vector<size_t>& needed_columns() const {
+		return NeededColumns;
+	}
+
+	//Must be called if fields are modified directly after the header has been parsed
+	void refresh_column_slices() {
+		ColumnSlices.clear();
+		ColumnSlices.reserve(ncolumns());
 		for (size_t i = 0; i < fields.size(); i++) {
-			cAsciiColumnField& f = fields[i];
-			std::string nullstr = f.nullstring();
+			const cAsciiColumnField& f = fields[i];
+			cColumnSlice c;
+			c.width = f.width;
+			c.nullstring = f.nullstring();
 			for (size_t j = 0; j < f.nbands; j++) {
-				const std::string s = trim(CurrentRecord.substr(f.startchar + j * f.width, f.width));
-				if (s == nullstr) {
-					cs.push_back(std::string());
-				}
-				else cs.push_back(s);
+				c.offset = f.startchar + j * f.width;
+				ColumnSlices.push_back(c);
 			}
 		}
-		return cs;
+		columnslices_valid = true;
+	}
+
+	const std::vector<cColumnSlice>& column_slices() {
+		if (columnslices_valid == false) refresh_column_slices();
+		return ColumnSlices;
+	}
+
+	static std::string_view fixed_width_column(const std::string_view record, const cColumnSlice& c) {
+		//Columns beyond the end of a short record are empty (null)
+		const std::string_view s = c.offset < record.size() ? trim_view(record.substr(c.offset, c.width)) : std::string_view();
+		if (s == c.nullstring) return std::string_view();
+		return s;
+	}
+
+	static size_t fixed_width_parse(const std::string_view record, const std::vector<cColumnSlice>& slices, std::vector<std::string_view>& views) {
+		views.resize(slices.size());
+		for (size_t i = 0; i < slices.size(); i++) {
+			views[i] = fixed_width_column(record, slices[i]);
+		}
+		return views.size();
+	}
+
+	static size_t delimited_parse(const std::string_view record, std::vector<std::string_view>& views) {
+		return tokenise_view(record, delimiters, views);
+	}
+
+	std::vector<std::string> delimited_parse() {
+		std::vector<std::string_view> tokens;
+		delimited_parse(RecordView, tokens);
+		return std::vector<std::string>(tokens.begin(), tokens.end());
+	}
+
+	std::vector<std::string> fixed_width_parse() {
+		std::vector<std::string_view> views;
+		fixed_width_parse(RecordView, column_slices(), views);
+		return std::vector<std::string>(views.begin(), views.end());
+	}
+
+	//The column views point into the record's buffer, which the next record may overwrite or reallocate (eg std::getline
+	//in STREAM mode), so they are dropped when a record is loaded and are only valid again after parse_record()
+	void clear_columns() {
+		RecordGeneration++;
+		colviews.clear();
+		colstrings_current = false;
+		DelimitedNParsed = 0;
+		DelimitedResume = 0;
 	}
 
 	size_t parse_record() {
+		RecordGeneration++;
+		colstrings_current = false;
+		if (NeededColumns.size() > 0) {
+			return parse_record_projected();
+		}
+		if (parsetype == cAsciiColumnFile::ParseType::FIXEDWIDTH) {
+			fixed_width_parse(RecordView, column_slices(), colviews);
+		}
+		else {
+			delimited_parse(RecordView, colviews);
+		}
+		return colviews.size();
+	}
+
+	//Parses only the needed columns, the other column views are left empty until they are accessed.
+	//The column count is still that of the whole record, so parse_record() != ncolumns() continues to detect bad records.
+	size_t parse_record_projected() {
 		if (parsetype == cAsciiColumnFile::ParseType::FIXEDWIDTH) {
-			colstrings = fixed_width_parse();
+			const std::vector<cColumnSlice>& slices = column_slices();
+			colviews.resize(slices.size());
+			ColumnGeneration.resize(slices.size(), 0);
+			for (const size_t& c : NeededColumns) {
+				if (c >= slices.size()) break;
+				colviews[c] = fixed_width_column(RecordView, slices[c]);
+				ColumnGeneration[c] = RecordGeneration;
+			}
 		}
 		else {
-			colstrings = delimited_parse();
+			//Tokenise up to the last needed column and only count the rest
+			colviews.resize(NeededColumns.back() + 1);
+			DelimitedNParsed = 0;
+			DelimitedResume = 0;
+			parse_delimited_columns(colviews.size());
+			const size_t n = DelimitedNParsed + count_tokens(RecordView, delimiters, DelimitedResume);
+			colviews.resize(n);
+		}
+		return colviews.size();
+	}
+
+	//Tokenises delimited columns [DelimitedNParsed, n) of the current record into colviews
+	void parse_delimited_columns(const size_t n) const {
+		size_t p = DelimitedResume;
+		while (DelimitedNParsed < n) {
+			p = RecordView.find_first_not_of(delimiters, p);
+			if (p == std::string_view::npos) break;
+			const size_t q = RecordView.find_first_of(delimiters, p);
+			colviews[DelimitedNParsed++] = RecordView.substr(p, q == std::string_view::npos ? q : q - p);
+			p = q;
+		}
+		DelimitedResume = p;
+	}
+
+	//Parse a column skipped by projection if it has not been parsed for the current record yet
+	void ensure_column_parsed(const size_t& c) const {
+		if (NeededColumns.size() == 0 || c >= colviews.size()) return;
+		if (parsetype == cAsciiColumnFile::ParseType::FIXEDWIDTH) {
+			if (ColumnGeneration[c] != RecordGeneration) {
+				colviews[c] = fixed_width_column(RecordView, ColumnSlices[c]);
+				ColumnGeneration[c] = RecordGeneration;
+			}
 		}
-		return colstrings.size();
+		else if (c >= DelimitedNParsed) {
+			parse_delimited_columns(c + 1);
+		}
+	}
+
+	void ensure_all_columns_parsed() const {
+		if (NeededColumns.size() == 0) return;
+		for (size_t c = 0; c < colviews.size(); c++) ensure_column_parsed(c);
 	}
 
 	size_t ncolumns() {
@@ -503,19 +1721,8 @@ public:
 	template<typename T>
 	inline void getcolumn(const size_t& columnnumber, T& v) const
 	{
-		if (columnnumber >= colstrings.size()) {
-			std::string msg = _SRC_;
-			msg += strprint("\n\tError trying to access column %zu when there are only %zu columns in the current record string (check format and delimiters)\nCurrent record is\n%s\n", columnnumber + 1, colstrings.size(), CurrentRecord.c_str());
-			throw(std::runtime_error(msg));
-		}
-		else {
-			if (colstrings[columnnumber].size() == 0) {
-				v = undefinedvalue<T>();
-			}
-			else {
-				std::istringstream(colstrings[columnnumber]) >> v;
-			}
-		}
+		ensure_column_parsed(columnnumber);
+		cAsciiColumnRecord::getcolumn(colviews, RecordView, columnnumber, v);
 	};
 
 	template<typename T>
@@ -607,22 +1814,22 @@ public:
 		return readstatus;
 	};
 
-	size_t readnextgroup(const size_t& fgroupindex, std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& doublefields) {
+	//Reads the records of the next group (consecutive records with the same value of field fgroupindex, eg a line) into batch.
+	//The values are converted straight from the column strings into the batch's buffers, which are reused between groups.
+	//If the batch has not been setup all fields are selected.
+	size_t readnextgroup(const size_t& fgroupindex, cColumnarBatch& batch) {
 
-		size_t nfields = fields.size();
-		size_t numcolumns = ncolumns();
-		if (IFS.eof()) return 0;
+		if (batch.issetup() == false) batch.setup(fields);
+		batch.clear();
 
-		intfields.clear();
-		doublefields.clear();
-		intfields.resize(fields.size());
-		doublefields.resize(fields.size());
+		const size_t numcolumns = ncolumns();
+		if (eof()) return 0;
 
 		int lastline;
 		size_t count = 0;
 		//Leave the last read record (from the next line) up the spout for next time
 		do {
-			if (CurrentRecord.empty()) {
+			if (RecordView.empty()) {
 				load_next_record();//Put the first record in
 			}
 
@@ -637,28 +1844,300 @@ public:
 
 			if (line != lastline) return count;
 
-			for (size_t fi = 0; fi < nfields; fi++) {
-				size_t nbands = fields[fi].nbands;
-				if (fields[fi].datatype() == cAsciiColumnField::Type::INTEGER) {
-					std::vector<int> vec;
-					getfieldbyindex(fi, vec);
-					for (size_t bi = 0; bi < nbands; bi++) {
-						intfields[fi].push_back(vec[bi]);
-					}
-				}
-				else {
-					std::vector<double> vec;
-					getfieldbyindex(fi, vec);
-					for (size_t bi = 0; bi < nbands; bi++) {
-						doublefields[fi].push_back(vec[bi]);
-					}
+			if (NeededColumns.size() > 0) {
+				for (size_t k = 0; k < batch.ncolumns(); k++) {
+					const cColumnarBatch::cColumn& c = batch.column(k);
+					for (size_t bi = 0; bi < c.nbands; bi++) ensure_column_parsed(c.startcol + bi);
 				}
 			}
+			batch.append(colviews);
 			count++;
 		} while (load_next_record());
 		return count;
 	};
 
+	size_t readnextgroup(const size_t& fgroupindex, std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& doublefields) {
+		if (eof()) return 0;
+		if (GroupBatch.ncolumns() != fields.size()) GroupBatch.setup(fields);
+		size_t count = readnextgroup(fgroupindex, GroupBatch);
+		GroupBatch.copy_to(intfields, doublefields);
+		return count;
+	};
+
+	//Calls func(const cAsciiColumnRecord&) for each record in [firstrecord, firstrecord + count) on nthreads threads (0 = all hardware threads).
+	//The record range is split into chunks of chunksize records by RecordLength, so no scan of the file is needed,
+	//or for variable length records by the record offset index (best with chunksize a multiple of its stride).
+	//Each thread has its own parse state and, in STREAM mode, its own file handle, so the current record is not disturbed.
+	//Compressed files are inflated by one reader whose chunks are handed out in order under a lock, so only the parsing is parallel.
+	//func is called concurrently and must only write to per record storage (eg indexed by record.index). 
+	//func may also take the zero based worker number (< nthreads) as a second argument, eg to update per thread accumulators.
+	//Empty records are skipped, records that did not parse have record.columns.size() != ncolumns().
+	//With the default firstrecord and count the record range (set_record_range) is used if one is set.
+	template<typename Func>
+	size_t parallel_for_each_record(Func func, size_t nthreads = 0, size_t firstrecord = 0, size_t count = undefinedvalue<size_t>(), const size_t chunksize = 16384)
+	{
+		if (RecordLength == 0) return 0;
+		if (firstrecord == 0 && count == undefinedvalue<size_t>() && has_record_range()) {
+			firstrecord = RangeFirst;
+			count = RangeEnd - RangeFirst;
+		}
+		const size_t nr = nrecords();
+		if (firstrecord >= nr) return 0;
+		if (count == undefinedvalue<size_t>() || firstrecord + count > nr) count = nr - firstrecord;
+		if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+		const size_t nchunks = (count + chunksize - 1) / chunksize;
+		if (nthreads > nchunks) nthreads = nchunks;
+
+		//Byte offsets of the chunks when they cannot be computed from RecordLength
+		const bool byoffset = (VariableLength || OffsetStride > 0 || Compressed);
+		std::vector<size_t> chunkoffsets;
+		if (byoffset && Compressed == false) {
+			chunkoffsets.resize(nchunks + 1);
+			for (size_t ci = 0; ci < nchunks; ci++) {
+				chunkoffsets[ci] = record_offset(firstrecord + ci * chunksize);
+			}
+			chunkoffsets[nchunks] = record_offset(firstrecord + count);
+		}
+
+		const std::vector<cColumnSlice>& slices = column_slices();
+		std::atomic<size_t> nextchunk(0);
+		std::atomic<size_t> nprocessed(0);
+		std::exception_ptr error = nullptr;
+		std::mutex errormutex;
+
+		//Compressed input is inflated sequentially, the chunks are handed out in order and parsed in parallel
+		std::unique_ptr<cRecordReader> inflater;
+		std::mutex inflatermutex;
+		if (Compressed) {
+			inflater = std::make_unique<cRecordReader>(make_reader(0));
+			std::vector<char> skipped;
+			for (size_t r = 0; r < firstrecord; r += chunksize) {
+				inflater->read_records(std::min(chunksize, firstrecord - r), skipped);
+			}
+		}
+
+		auto worker = [&](const size_t workerindex) {
+			try {
+				cAsciiColumnRecord rec;
+				rec.pfields = &fields;
+				std::ifstream ifs;
+				std::vector<char> buf;
+				if (readmode == ReadMode::STREAM && Compressed == false) {
+					ifs.open(FileName, std::ifstream::in | std::ifstream::binary);
+					if (!ifs) throw(std::runtime_error(_SRC_ + strprint("\nCould not open file %s\n", FileName.c_str())));
+				}
+
+				while (true) {
+					size_t ci, r1, r2, b1, b2;
+					const char* p;
+					if (Compressed) {
+						std::lock_guard<std::mutex> lock(inflatermutex);
+						if ((ci = nextchunk++) >= nchunks) break;
+						r1 = firstrecord + ci * chunksize;
+						r2 = std::min(r1 + chunksize, firstrecord + count);
+						inflater->read_records(r2 - r1, buf);
+						b1 = 0;
+						b2 = buf.size();
+						p = buf.data();
+					}
+					else {
+						if ((ci = nextchunk++) >= nchunks) break;
+						r1 = firstrecord + ci * chunksize;
+						r2 = std::min(r1 + chunksize, firstrecord + count);
+						b1 = byoffset ? chunkoffsets[ci] : r1 * RecordLength;
+						b2 = byoffset ? chunkoffsets[ci + 1] : std::min(r2 * RecordLength, FileSize);
+						if (readmode == ReadMode::MMAP) {
+							p = MMF.data() + b1;
+						}
+						else {
+							buf.resize(b2 - b1);
+							ifs.clear();
+							ifs.seekg((std::streamoff)b1, ifs.beg);
+							ifs.read(buf.data(), (std::streamsize)buf.size());
+							p = buf.data();
+						}
+					}
+
+					size_t n = 0;
+					auto process = [&](const size_t ri, const std::string_view str) {
+						if (str.size() == 0) return;
+						rec.index = ri;
+						rec.str = str;
+						if (parsetype == ParseType::FIXEDWIDTH) {
+							fixed_width_parse(rec.str, slices, rec.columns);
+						}
+						else {
+							delimited_parse(rec.str, rec.columns);
+						}
+						if constexpr (std::is_invocable_v<Func, const cAsciiColumnRecord&, size_t>) {
+							func((const cAsciiColumnRecord&)rec, workerindex);
+						}
+						else {
+							func((const cAsciiColumnRecord&)rec);
+						}
+						n++;
+					};
+
+					if (byoffset) {
+						const char* q = p;
+						const char* end = p + (b2 - b1);
+						for (size_t ri = r1; ri < r2 && q < end; ri++) {
+							const char* nl = findchar(q, end, newline);
+							process(ri, std::string_view(q, (size_t)(nl - q)));
+							q = (nl == end) ? end : nl + 1;
+						}
+					}
+					else {
+						for (size_t ri = r1; ri < r2; ri++) {
+							const size_t off = (ri - r1) * RecordLength;
+							size_t len = std::min(RecordLength, b2 - b1 - off);
+							if (len > 0 && p[off + len - 1] == newline) len--;
+							process(ri, std::string_view(p + off, len));
+						}
+					}
+					nprocessed += n;
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(errormutex);
+				if (error == nullptr) error = std::current_exception();
+				nextchunk = nchunks;//stop the other threads early
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < nthreads; i++) {
+			threads.emplace_back(worker, i);
+		}
+		worker(0);
+		for (auto& t : threads) t.join();
+		if (error) std::rethrow_exception(error);
+		return nprocessed;
+	}
+
+	//Reads the fields with indices findices of every record into data[k] (nrecords() * nbands values for findices[k]) in record order using nthreads threads.
+	//Values of records that are empty or do not parse to ncolumns() columns are undefinedvalue<T>().
+	template<typename T>
+	size_t parallel_getfields(const std::vector<size_t>& findices, std::vector<std::vector<T>>& data, const size_t nthreads = 0)
+	{
+		const size_t nr = nrecords();
+		const size_t numcolumns = ncolumns();
+		data.resize(findices.size());
+		for (size_t k = 0; k < findices.size(); k++) {
+			data[k].assign(nr * fields[findices[k]].nbands, undefinedvalue<T>());
+		}
+
+		auto func = [&](const cAsciiColumnRecord& rec) {
+			if (rec.columns.size() != numcolumns) return;
+			for (size_t k = 0; k < findices.size(); k++) {
+				const cAsciiColumnField& f = fields[findices[k]];
+				T* v = data[k].data() + rec.index * f.nbands;
+				for (size_t bi = 0; bi < f.nbands; bi++) {
+					rec.getcolumn(f.startcol() + bi, v[bi]);
+				}
+			}
+		};
+		return parallel_for_each_record(func, nthreads);
+	}
+
+	//Stats, histogram (of at most nbins bins) and null count of every numeric column from one parallel pass over the records (or the record range).
+	//Each thread accumulates its own cStatsAccumulator and cMergeableHistogram for each column and these are merged at the end.
+	//Empty columns and those matching the field's null string are nulls, as are values that do not convert to a finite number (eg abc, nan or inf).
+	//Character fields only get null counts. Records that do not parse to ncolumns() columns are skipped.
+	std::vector<cColumnProfile> profile_columns(size_t nthreads = 0, const size_t nbins = 256)
+	{
+		if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+		const size_t numcolumns = ncolumns();
+		const std::vector<cColumnSlice>& slices = column_slices();
+
+		std::vector<char> ischar(numcolumns, 0);
+		for (size_t fi = 0; fi < fields.size(); fi++) {
+			for (size_t bi = 0; bi < fields[fi].nbands; bi++) {
+				ischar[fields[fi].startcol() + bi] = fields[fi].ischar() ? 1 : 0;
+			}
+		}
+
+		std::vector<std::vector<cStatsAccumulator<double>>> stats(nthreads, std::vector<cStatsAccumulator<double>>(numcolumns));
+		std::vector<std::vector<cMergeableHistogram<double>>> hists(nthreads, std::vector<cMergeableHistogram<double>>(numcolumns, cMergeableHistogram<double>(nbins)));
+
+		auto func = [&](const cAsciiColumnRecord& rec, const size_t wi) {
+			if (rec.columns.size() != numcolumns) return;
+			std::vector<cStatsAccumulator<double>>& st = stats[wi];
+			std::vector<cMergeableHistogram<double>>& hs = hists[wi];
+			for (size_t c = 0; c < numcolumns; c++) {
+				const std::string_view s = rec.columns[c];
+				//Fixed width parsing has already emptied columns matching the null string but delimited parsing has not
+				if (s.empty() || s == slices[c].nullstring) {
+					st[c].addnull();
+					continue;
+				}
+				if (ischar[c]) {
+					st[c].add(0.0);
+					continue;
+				}
+				double v;
+				if (field2num(s, v) == false || std::isfinite(v) == false || v == undefinedvalue<double>()) {
+					st[c].addnull();
+					continue;
+				}
+				st[c].add(v);
+				hs[c].add(v);
+			}
+		};
+		parallel_for_each_record(func, nthreads);
+
+		std::vector<cColumnProfile> profiles;
+		profiles.reserve(numcolumns);
+		for (size_t fi = 0; fi < fields.size(); fi++) {
+			const cAsciiColumnField& f = fields[fi];
+			for (size_t bi = 0; bi < f.nbands; bi++) {
+				const size_t c = f.startcol() + bi;
+				for (size_t t = 1; t < nthreads; t++) {
+					stats[0][c].merge(stats[t][c]);
+					hists[0][c].merge(hists[t][c]);
+				}
+				cColumnProfile p;
+				p.fieldindex = fi;
+				p.band = bi;
+				p.name = f.nbands > 1 ? strprint("%s[%zu]", f.name.c_str(), bi) : f.name;
+				p.stats = stats[0][c].stats();
+				if (f.ischar()) {
+					//Only the counts mean anything for character columns
+					p.stats.min = p.stats.max = p.stats.mean = p.stats.var = p.stats.std = undefinedvalue<double>();
+				}
+				else {
+					p.histogram = hists[0][c].histogram();
+				}
+				profiles.push_back(p);
+			}
+		}
+		return profiles;
+	}
+
+#ifdef ENABLE_MPI
+	//Sets this rank's record range to its contiguous share of the file so that each rank reads only its own records.
+	//If linefieldindex >= 0 the shares are aligned to the line boundaries found by scan_for_line_index (on rank 0) so that no line is split across ranks.
+	bool mpi_partition_records(const int linefieldindex = -1, cMpiComm comm = cMpiComm(cMpiEnv::world_comm())) {
+		const int size = comm.size();
+		const int rank = comm.rank();
+		clear_record_range();
+		std::vector<size_t> bounds;
+		if (rank == 0) {
+			if (linefieldindex < 0) {
+				bounds = partition_records(nrecords(), (size_t)size);
+			}
+			else {
+				std::vector<unsigned int> line_index_start, line_index_count, line_number;
+				scan_for_line_index(linefieldindex, line_index_start, line_index_count, line_number);
+				bounds = partition_lines(line_index_start, line_index_count, (size_t)size);
+			}
+		}
+		comm.bcast(bounds);
+		return set_record_range(bounds[rank], bounds[rank + 1] - bounds[rank]);
+	}
+#endif
+
 	size_t scan_for_line_index(const int& field_index, std::vector<unsigned int>& line_index_start, std::vector<unsigned int>& line_index_count, std::vector<unsigned int>& line_number)
 	{
 		_GSTITEM_
@@ -666,15 +2145,28 @@ public:
 		const size_t& i1 = fields[fi].startchar;
 		const size_t& width = fields[fi].width;
 
+		//A compressed file is only scanned if no earlier pass has built the line index
+		if (Compressed && has_record_range() == false) {
+			PassLineIndex.setfield(field_index);
+			if (PassLineIndex.complete) {
+				line_index_start.insert(line_index_start.end(), PassLineIndex.start.begin(), PassLineIndex.start.end());
+				line_index_count.insert(line_index_count.end(), PassLineIndex.count.begin(), PassLineIndex.count.end());
+				line_number.insert(line_number.end(), PassLineIndex.number.begin(), PassLineIndex.number.end());
+				return nrecords();
+			}
+		}
+
 		unsigned int lastline = -1;
 		rewind();
+		const unsigned int first = (unsigned int)RangeFirst;
 		unsigned int nread = 0;
 		while (load_next_record()) {
-			std::string t = CurrentRecord.substr(i1, width);
-			unsigned int lnum = atoi(t.data());
+			int ival;
+			str2num_fast(RecordView.substr(i1, width), ival);
+			unsigned int lnum = (unsigned int)ival;
 			if (nread == 0 || lnum != lastline) {
 				line_number.push_back(lnum);
-				line_index_start.push_back(nread);
+				line_index_start.push_back(first + nread);
 				line_index_count.push_back(1);
 				lastline = lnum;
 			}
@@ -694,15 +2186,16 @@ public:
 		size_t nltocheck = std::min((size_t)4, line_index_count.size());
 		rewind();
 		for (size_t li = 0; li < nltocheck; li++) {
-			std::string first = get_next_record();
+			const std::string first = get_next_record();
 			for (size_t si = 1; si < line_index_count[li]; si++) {
-				std::string current = get_next_record();
+				load_next_record();
+				const std::string_view current = RecordView;
 				for (size_t fi = 0; fi < fields.size(); fi++) {
 					if (groupby[fi] == true) {//do not check fields already known to not be groupby						
 						const size_t& i1 = fields[fi].startchar;
 						const size_t& width = fields[fi].width;
-						std::string a = first.substr(i1, width);
-						std::string b = current.substr(i1, width);
+						std::string_view a = std::string_view(first).substr(i1, width);
+						std::string_view b = current.substr(i1, width);
 						if (a != b) groupby[fi] = false;
 					}
 				}
@@ -711,5 +2204,307 @@ public:
 		rewind();
 		return groupby;
 	};
+
+	//Sidecar file in which load_or_build_line_index() caches the line index
+	std::string line_index_cache_path() const {
+		return FileName + ".lineindex";
+	};
+
+	//Key identifying the data file (path, size and modification time) for sidecar caches
+	std::string datafile_cache_key() const {
+		std::error_code ec;
+		const std::filesystem::path abspath = std::filesystem::absolute(FileName, ec);
+		const int64_t mtime = (int64_t)std::filesystem::last_write_time(FileName, ec).time_since_epoch().count();
+		std::string key = strprint("datafile %s\n", abspath.string().c_str());
+		key += strprint("size %zu\n", FileSize);
+		key += strprint("mtime %lld\n", (long long)mtime);
+		return key;
+	};
+
+	//Key identifying the data file and the field definitions a cached line index was built for
+	std::string line_index_cache_key(const int& field_index) const {
+		std::string key = datafile_cache_key();
+		key += strprint("linefield %d %zu %zu\n", field_index, fields[field_index].startchar, fields[field_index].width);
+		key += strprint("fields %zu", fields.size());
+		for (size_t fi = 0; fi < fields.size(); fi++) {
+			key += strprint(" %zu:%zu:%zu", fields[fi].startchar, fields[fi].width, fields[fi].nbands);
+		}
+		key += "\n";
+		return key;
+	};
+
+	bool write_line_index_cache(const std::string& cachepath, const int& field_index, const std::vector<unsigned int>& line_index_start, const std::vector<unsigned int>& line_index_count, const std::vector<unsigned int>& line_number, const std::vector<bool>& groupby) const {
+		return write_sidecar_atomically(cachepath, [&](std::ofstream& ofs) {
+			ofs << "ASCIICOLUMNFILE_LINEINDEX 1\n";
+			ofs << line_index_cache_key(field_index);
+			ofs << "nlines " << line_number.size() << "\n";
+			ofs << "groupby ";
+			for (size_t fi = 0; fi < groupby.size(); fi++) ofs << (groupby[fi] ? '1' : '0');
+			ofs << "\n";
+			for (size_t li = 0; li < line_number.size(); li++) {
+				ofs << line_number[li] << " " << line_index_start[li] << " " << line_index_count[li] << "\n";
+			}
+		});
+	};
+
+	bool read_line_index_cache(const std::string& cachepath, const int& field_index, std::vector<unsigned int>& line_index_start, std::vector<unsigned int>& line_index_count, std::vector<unsigned int>& line_number, std::vector<bool>& groupby) const {
+		std::ifstream ifs(cachepath);
+		if (!ifs) return false;
+
+		std::string line;
+		if (!std::getline(ifs, line) || line != "ASCIICOLUMNFILE_LINEINDEX 1") return false;
+
+		//The key lines must match exactly, otherwise the cache is stale
+		const std::string key = line_index_cache_key(field_index);
+		std::string filekey;
+		const size_t nkeylines = (size_t)std::count(key.begin(), key.end(), '\n');
+		for (size_t k = 0; k < nkeylines; k++) {
+			if (!std::getline(ifs, line)) return false;
+			filekey += line + "\n";
+		}
+		if (filekey != key) return false;
+
+		std::string token;
+		size_t nlines;
+		if (!(ifs >> token >> nlines) || token != "nlines") return false;
+
+		std::string flags;
+		if (!(ifs >> token >> flags) || token != "groupby" || flags.size() != fields.size()) return false;
+
+		std::vector<unsigned int> start(nlines), count(nlines), number(nlines);
+		for (size_t li = 0; li < nlines; li++) {
+			if (!(ifs >> number[li] >> start[li] >> count[li])) return false;
+		}
+		line_index_start = std::move(start);
+		line_index_count = std::move(count);
+		line_number = std::move(number);
+		groupby.resize(flags.size());
+		for (size_t fi = 0; fi < flags.size(); fi++) groupby[fi] = (flags[fi] == '1');
+		return true;
+	};
+
+	//Loads the line index and groupby flags from the sidecar cache if it is up to date, otherwise scans the file and rewrites the cache.
+	//Returns true if the cache was used. The cache is not used when a record range is set.
+	bool load_or_build_line_index(const int& field_index, std::vector<unsigned int>& line_index_start, std::vector<unsigned int>& line_index_count, std::vector<unsigned int>& line_number, std::vector<bool>& groupby, std::string cachepath = std::string())
+	{
+		_GSTITEM_
+		if (cachepath.empty()) cachepath = line_index_cache_path();
+		const bool usecache = (has_record_range() == false);
+
+		line_index_start.clear();
+		line_index_count.clear();
+		line_number.clear();
+		if (usecache && read_line_index_cache(cachepath, field_index, line_index_start, line_index_count, line_number, groupby)) {
+			return true;
+		}
+
+		line_index_start.clear();
+		line_index_count.clear();
+		line_number.clear();
+		scan_for_line_index(field_index, line_index_start, line_index_count, line_number);
+		groupby = scan_for_groupby_fields(line_index_count);
+
+		bool writer = usecache;
+#ifdef ENABLE_MPI
+		writer = writer && (cMpiEnv::world_rank() == 0);
+#endif
+		if (writer) {
+			if (write_line_index_cache(cachepath, field_index, line_index_start, line_index_count, line_number, groupby) == false) {
+				glog.warningmsg(_SRC_, "Unable to write line index cache file %s\n", cachepath.c_str());
+			}
+		}
+		return false;
+	};
+};
+
+//A cFieldDefinition resolved against a cAsciiColumnFile's fields once, so that reading it for each record
+//needs no field name lookup and applies the flip and operator with a function specialised for them
+class cBoundFieldDefinition {
+
+public:
+	enum class SOURCE { NUMERIC, COLUMNS, UNAVAILABLE };
+
+	template<typename T>
+	using TransformFunc = void(*)(T* v, const size_t n, const double opval);
+
+private:
+
+	template<typename T, bool FLIP, char OP>
+	static void transform(T* v, const size_t n, const double opval) {
+		const T udval = undefinedvalue<T>();
+		const T ov = (T)opval;
+		for (size_t i = 0; i < n; i++) {
+			if (v[i] == udval) continue;
+			if constexpr (FLIP) v[i] *= (T)-1;
+			if constexpr (OP == '+') v[i] += ov;
+			else if constexpr (OP == '-') v[i] -= ov;
+			else if constexpr (OP == '*') v[i] *= ov;
+			else if constexpr (OP == '/') v[i] /= ov;
+		}
+	}
+
+	template<typename T, bool FLIP>
+	static TransformFunc<T> select_op_transform(const char op) {
+		switch (op) {
+		case '+': return &transform<T, FLIP, '+'>;
+		case '-': return &transform<T, FLIP, '-'>;
+		case '*': return &transform<T, FLIP, '*'>;
+		case '/': return &transform<T, FLIP, '/'>;
+		default: return FLIP ? &transform<T, FLIP, ' '> : nullptr;
+		}
+	}
+
+	TransformFunc<double> tf_double = nullptr;
+	TransformFunc<float> tf_float = nullptr;
+	TransformFunc<int> tf_int = nullptr;
+
+public:
+	std::string keyname;
+	SOURCE source = SOURCE::UNAVAILABLE;
+	size_t column = 0;//Zero based start column for SOURCE::COLUMNS
+	size_t n = 0;//Number of values
+	std::vector<double> numericvalue;
+	bool flip = false;
+	char op = ' ';
+	double opval = 0.0;
+
+	//Transform that applies the flip and operator to non-null values, nullptr if there is nothing to do
+	template<typename T>
+	static TransformFunc<T> select_transform(const bool flip, const char op) {
+		if (flip) return select_op_transform<T, true>(op);
+		return select_op_transform<T, false>(op);
+	}
+
+	cBoundFieldDefinition() {};
+
+	//nvalues is the number of values read for column number, numeric and unavailable definitions, variable names read all the field's bands
+	cBoundFieldDefinition(const cAsciiColumnFile& F, const cFieldDefinition& fd, const size_t& nvalues = 1) {
+		keyname = fd.keyname;
+		n = nvalues;
+		flip = fd.flip;
+		op = fd.op;
+		opval = fd.opval;
+		if (op != ' ' && op != '+' && op != '-' && op != '*' && op != '/') {
+			glog.warningmsg(_SRC_, "Unknown operator %c\n", op);
+			op = ' ';
+		}
+
+		if (fd.type == cFieldDefinition::TYPE::NUMERIC) {
+			source = SOURCE::NUMERIC;
+			numericvalue = fd.numericvalue;
+		}
+		else if (fd.type == cFieldDefinition::TYPE::COLUMNNUMBER) {
+			source = SOURCE::COLUMNS;
+			column = fd.column - 1;
+		}
+		else if (fd.type == cFieldDefinition::TYPE::VARIABLENAME) {
+			int findex = F.fieldindexbyname(fd.varname);
+			if (findex < 0) {
+				glog.errormsg(_SRC_, "Could not find a field named %s\n", fd.varname.c_str());
+			}
+			source = SOURCE::COLUMNS;
+			column = (size_t)F.fields[findex].startcol();
+			n = F.fields[findex].nbands;
+		}
+		else {
+			source = SOURCE::UNAVAILABLE;
+		}
+
+		tf_double = select_transform<double>(flip, op);
+		tf_float = select_transform<float>(flip, op);
+		tf_int = select_transform<int>(flip, op);
+	};
+
+	template<typename T>
+	TransformFunc<T> get_transform() const {
+		if constexpr (std::is_same<T, double>::value) return tf_double;
+		else if constexpr (std::is_same<T, float>::value) return tf_float;
+		else if constexpr (std::is_same<T, int>::value) return tf_int;
+		else return select_transform<T>(flip, op);
+	}
+
+	//Reads the n values of the definition from F's current (parsed) record into v, same results as cAsciiColumnFile::getvec_fielddefinition
+	template<typename T>
+	bool read(const cAsciiColumnFile& F, T* v) const {
+		if (source == SOURCE::COLUMNS) {
+			for (size_t i = 0; i < n; i++) F.getcolumn(column + i, v[i]);
+		}
+		else if (source == SOURCE::NUMERIC) {
+			const size_t deflen = numericvalue.size();
+			for (size_t i = 0; i < n; i++) {
+				v[i] = (T)(deflen == 1 ? numericvalue[0] : numericvalue[i]);
+			}
+		}
+		else {
+			const T udval = undefinedvalue<T>();
+			for (size_t i = 0; i < n; i++) v[i] = udval;
+			return false;
+		}
+		const TransformFunc<T> tf = get_transform<T>();
+		if (tf) tf(v, n, opval);
+		return true;
+	}
+
+	template<typename T>
+	bool read(const cAsciiColumnFile& F, std::vector<T>& vec) const {
+		vec.resize(n);
+		return read(F, vec.data());
+	}
+};
+
+//The bound definitions of a whole configuration (eg a cFDMap) read together for each record
+class cFieldReadPlan {
+
+	std::vector<cBoundFieldDefinition> Defs;
+
+public:
+
+	cFieldReadPlan() {};
+
+	//Column number, numeric and unavailable definitions read nvalues values, or the number of numeric values given
+	cFieldReadPlan(const cAsciiColumnFile& F, const cFDMap& fdmap, const size_t& nvalues = 1) {
+		for (const auto& [key, fd] : fdmap) {
+			size_t nv = nvalues;
+			if (fd.type == cFieldDefinition::TYPE::NUMERIC && fd.numericvalue.size() > 1) nv = fd.numericvalue.size();
+			add(F, fd, nv).keyname = key;
+		}
+	};
+
+	cBoundFieldDefinition& add(const cAsciiColumnFile& F, const cFieldDefinition& fd, const size_t& nvalues = 1) {
+		Defs.push_back(cBoundFieldDefinition(F, fd, nvalues));
+		return Defs.back();
+	};
+
+	size_t size() const { return Defs.size(); };
+
+	const cBoundFieldDefinition& operator[](const size_t& i) const { return Defs[i]; };
+
+	//Index of a definition by key name, to be looked up once rather than per record
+	int index(const std::string& key) const {
+		for (size_t i = 0; i < Defs.size(); i++) {
+			if (strcasecmp(Defs[i].keyname, key) == 0) return (int)i;
+		}
+		return -1;
+	};
+
+	//Zero based columns read by the plan, eg for cAsciiColumnFile::set_needed_columns()
+	std::vector<size_t> columns() const {
+		std::vector<size_t> c;
+		for (const cBoundFieldDefinition& d : Defs) {
+			if (d.source != cBoundFieldDefinition::SOURCE::COLUMNS) continue;
+			for (size_t i = 0; i < d.n; i++) c.push_back(d.column + i);
+		}
+		return c;
+	};
+
+	//Reads all the definitions from F's current (parsed) record, values[i] is resized to Defs[i].n
+	template<typename T>
+	void read(const cAsciiColumnFile& F, std::vector<std::vector<T>>& values) const {
+		values.resize(Defs.size());
+		for (size_t i = 0; i < Defs.size(); i++) {
+			Defs[i].read(F, values[i]);
+		}
+	};
 };
+
 #endif
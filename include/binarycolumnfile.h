@@ -0,0 +1,433 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _binarycolumnfile_H
+#define _binarycolumnfile_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include "general_utils.h"
+#include "string_utils.h"
+#include "file_formats.h"
+#include "asciicolumnfile.h"
+#include "memorymappedfile.h"
+
+//Binary columnar copy of an ASCII column file (eg ASEG-GDF) that is memory mapped for reading.
+//Each band of each field is one contiguous array of nrecords values: int32 for integer fields, double for real fields
+//and width bytes (zero padded) for character fields. Nulls are stored as undefinedvalue<T>().
+//Records that did not parse are stored as all nulls, so record numbers are the same as in the ASCII file.
+//
+//Layout (native byte order, checked on reading):
+//	char[8] magic, uint32 byte order marker, uint32 version, uint64 header length, text header, then the arrays each 64 byte aligned.
+//	The text header has the record count, the fields (name, format, nbands, array offset, null string and attributes, tab separated)
+//	and the optional line index (line number, start record and record count arrays).
+class cBinaryColumnFile {
+
+	static constexpr const char* MAGIC = "ASCOLBIN";
+	static constexpr uint32_t BYTEORDER = 0x01020304;
+	static constexpr uint32_t VERSION = 1;
+	static constexpr size_t ALIGNMENT = 64;
+
+	cMemoryMappedFile MMF;
+	const char* pData = nullptr;//Start of the arrays
+	size_t NRecords = 0;
+	std::vector<size_t> FieldOffsets;//Byte offset of each field's first band array from pData
+	size_t LineOffset = 0;
+	size_t NLines = 0;
+
+	static size_t align(const size_t n) {
+		return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	static size_t value_size(const cAsciiColumnField& f) {
+		if (f.isinteger()) return sizeof(int32_t);
+		if (f.ischar()) return f.width;
+		return sizeof(double);
+	}
+
+	static size_t band_bytes(const cAsciiColumnField& f, const size_t& nrecords) {
+		return align(nrecords * value_size(f));
+	}
+
+	static std::string tabsafe(std::string s) {
+		for (char& c : s) if (c == '\t' || c == '\n') c = ' ';
+		return s;
+	}
+
+	void check_band(const size_t& findex, const size_t& band) const {
+		if (findex >= fields.size() || band >= fields[findex].nbands) {
+			std::string msg = _SRC_ + strprint("\n\tField %zu band %zu does not exist in %s\n", findex, band, MMF.path().c_str());
+			throw(std::runtime_error(msg));
+		}
+	}
+
+public:
+
+	std::vector<cAsciiColumnField> fields;
+	std::vector<unsigned int> line_number;
+	std::vector<unsigned int> line_index_start;
+	std::vector<unsigned int> line_index_count;
+
+	cBinaryColumnFile() {};
+
+	cBinaryColumnFile(const std::string& path) {
+		open(path);
+	};
+
+	//Converts the ASCII file A (whose header has been parsed) to a binary columnar file at path.
+	//If linefieldindex >= 0 the line index of that field is embedded. Records are parsed on nthreads threads in windows
+	//sized so that the column buffers of a window take about windowbytes bytes.
+	static size_t convert(cAsciiColumnFile& A, const std::string& path, const int linefieldindex = -1, const size_t nthreads = 0, const size_t windowbytes = 268435456)
+	{
+		const std::vector<cAsciiColumnField>& flds = A.fields;
+		const size_t nr = A.nrecords();
+		const size_t ncols = A.ncolumns();
+
+		//Byte offsets of the arrays from the start of the data
+		std::vector<size_t> offsets(flds.size());
+		size_t off = 0;
+		for (size_t fi = 0; fi < flds.size(); fi++) {
+			offsets[fi] = off;
+			off += flds[fi].nbands * band_bytes(flds[fi], nr);
+		}
+		const size_t dataend = off;
+
+		//Parse windows of records into per column buffers and write each column's part of the window into its array
+		std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+		if (!ofs) {
+			glog.errormsg(_SRC_, "Could not open file %s\n", path.c_str());
+		}
+
+		std::vector<unsigned int> lnum, lstart, lcount;
+		size_t recordbytes = 0;
+		for (size_t fi = 0; fi < flds.size(); fi++) {
+			recordbytes += flds[fi].nbands * value_size(flds[fi]);
+		}
+		const size_t window = std::max((size_t)1, windowbytes / std::max((size_t)1, recordbytes));
+		std::vector<std::vector<char>> colbuf(ncols);
+		std::vector<int> linevalues;
+
+		//The header size is only known at the end, so the arrays are written at offsets from a reserved data start
+		//which is fixed first from an upper bound of the header length
+		const std::string provisional = make_header(flds, offsets, nr, dataend, nr);
+		const size_t datastart = align(24 + provisional.size() + 256);
+
+		for (size_t first = 0; first < nr; first += window) {
+			const size_t n = std::min(window, nr - first);
+			for (size_t fi = 0, c = 0; fi < flds.size(); fi++) {
+				for (size_t bi = 0; bi < flds[fi].nbands; bi++, c++) {
+					colbuf[c].resize(n * value_size(flds[fi]));
+					fill_null(flds[fi], colbuf[c].data(), n);
+				}
+			}
+			if (linefieldindex >= 0) linevalues.assign(n, undefinedvalue<int>());
+
+			auto func = [&](const cAsciiColumnRecord& rec) {
+				if (rec.columns.size() != ncols) return;
+				const size_t r = rec.index - first;
+				for (size_t fi = 0, c = 0; fi < flds.size(); fi++) {
+					const cAsciiColumnField& f = flds[fi];
+					for (size_t bi = 0; bi < f.nbands; bi++, c++) {
+						const std::string_view s = rec.columns[c];
+						if (f.isinteger()) {
+							int v;
+							field2num(s, v);
+							((int32_t*)colbuf[c].data())[r] = (int32_t)v;
+						}
+						else if (f.ischar()) {
+							std::memcpy(colbuf[c].data() + r * f.width, s.data(), std::min(s.size(), f.width));
+						}
+						else {
+							double v;
+							field2num(s, v);
+							((double*)colbuf[c].data())[r] = v;
+						}
+					}
+				}
+				if (linefieldindex >= 0) rec.getfieldbyindex((size_t)linefieldindex, linevalues[r]);
+			};
+			A.parallel_for_each_record(func, nthreads, first, n);
+
+			for (size_t fi = 0, c = 0; fi < flds.size(); fi++) {
+				const size_t vs = value_size(flds[fi]);
+				for (size_t bi = 0; bi < flds[fi].nbands; bi++, c++) {
+					const size_t pos = datastart + offsets[fi] + bi * band_bytes(flds[fi], nr) + first * vs;
+					ofs.seekp((std::streamoff)pos, std::ios::beg);
+					ofs.write(colbuf[c].data(), (std::streamsize)colbuf[c].size());
+				}
+			}
+
+			if (linefieldindex >= 0) {
+				for (size_t r = 0; r < n; r++) {
+					const int line = linevalues[r];
+					if (line == undefinedvalue<int>()) continue;
+					if (lnum.size() == 0 || (unsigned int)line != lnum.back()) {
+						lnum.push_back((unsigned int)line);
+						lstart.push_back((unsigned int)(first + r));
+						lcount.push_back(1);
+					}
+					else {
+						lcount.back()++;
+					}
+				}
+			}
+		}
+
+		//Line index arrays after the field arrays
+		const size_t nlines = lnum.size();
+		if (nlines > 0) {
+			ofs.seekp((std::streamoff)(datastart + dataend), std::ios::beg);
+			ofs.write((const char*)lnum.data(), (std::streamsize)(nlines * sizeof(unsigned int)));
+			ofs.write((const char*)lstart.data(), (std::streamsize)(nlines * sizeof(unsigned int)));
+			ofs.write((const char*)lcount.data(), (std::streamsize)(nlines * sizeof(unsigned int)));
+		}
+		else {
+			//Make sure the file extends to the end of the arrays
+			ofs.seekp((std::streamoff)(datastart + dataend), std::ios::beg);
+		}
+		const char pad = 0;
+		ofs.write(&pad, 1);
+
+		const std::string header = make_header(flds, offsets, nr, dataend, nlines);
+		if (24 + header.size() > datastart) {
+			glog.errormsg(_SRC_, "Header of %s is larger than the space reserved for it\n", path.c_str());
+		}
+		const uint32_t byteorder = BYTEORDER;
+		const uint32_t version = VERSION;
+		const uint64_t hlen = (uint64_t)(datastart - 24);
+		std::string hpadded = header;
+		hpadded.resize((size_t)hlen, ' ');
+		ofs.seekp(0, std::ios::beg);
+		ofs.write(MAGIC, 8);
+		ofs.write((const char*)&byteorder, sizeof(byteorder));
+		ofs.write((const char*)&version, sizeof(version));
+		ofs.write((const char*)&hlen, sizeof(hlen));
+		ofs.write(hpadded.data(), (std::streamsize)hpadded.size());
+		ofs.close();
+		if (!ofs) {
+			glog.errormsg(_SRC_, "Error writing file %s\n", path.c_str());
+		}
+		return nr;
+	}
+
+private:
+
+	static void fill_null(const cAsciiColumnField& f, char* buf, const size_t& n) {
+		if (f.isinteger()) {
+			int32_t* p = (int32_t*)buf;
+			for (size_t i = 0; i < n; i++) p[i] = (int32_t)undefinedvalue<int>();
+		}
+		else if (f.ischar()) {
+			std::memset(buf, 0, n * f.width);
+		}
+		else {
+			double* p = (double*)buf;
+			for (size_t i = 0; i < n; i++) p[i] = undefinedvalue<double>();
+		}
+	}
+
+	static std::string make_header(const std::vector<cAsciiColumnField>& flds, const std::vector<size_t>& offsets, const size_t& nr, const size_t& dataend, const size_t& nlines)
+	{
+		std::ostringstream h;
+		h << "nrecords\t" << nr << "\n";
+		h << "nfields\t" << flds.size() << "\n";
+		for (size_t fi = 0; fi < flds.size(); fi++) {
+			const cAsciiColumnField& f = flds[fi];
+			h << "field\t" << tabsafe(f.name) << "\t" << f.fmtchar << "\t" << f.width << "\t" << f.decimals << "\t" << f.nbands << "\t" << offsets[fi];
+			for (const auto& kv : f.atts) {
+				h << "\t" << tabsafe(kv.first) << "=" << tabsafe(kv.second);
+			}
+			h << "\n";
+		}
+		h << "lines\t" << nlines << "\t" << dataend << "\n";
+		h << "end\n";
+		return h.str();
+	}
+
+public:
+
+	bool open(const std::string& path) {
+		close();
+		if (MMF.open(path) == false) {
+			glog.errormsg(_SRC_, "Could not memory map file %s\n", path.c_str());
+		}
+		const char* p = MMF.data();
+		if (MMF.size() < 24 || std::memcmp(p, MAGIC, 8) != 0) {
+			glog.errormsg(_SRC_, "%s is not a binary column file\n", path.c_str());
+		}
+		uint32_t byteorder, version;
+		uint64_t hlen;
+		std::memcpy(&byteorder, p + 8, sizeof(byteorder));
+		std::memcpy(&version, p + 12, sizeof(version));
+		std::memcpy(&hlen, p + 16, sizeof(hlen));
+		if (byteorder != BYTEORDER) {
+			glog.errormsg(_SRC_, "%s was written with a different byte order\n", path.c_str());
+		}
+		if (version != VERSION) {
+			glog.errormsg(_SRC_, "%s has unsupported version %u\n", path.c_str(), version);
+		}
+		if (hlen > MMF.size() - 24) {
+			glog.errormsg(_SRC_, "Header length of %s is beyond the end of the file\n", path.c_str());
+		}
+		pData = p + 24 + hlen;
+		const size_t datasize = MMF.size() - 24 - (size_t)hlen;
+
+		std::istringstream h(std::string(p + 24, (size_t)hlen));
+		std::string line;
+		size_t startcolumn = 0;
+		size_t startchar = 0;
+		while (std::getline(h, line)) {
+			std::vector<std::string> t = fieldparsestring(line.c_str(), "\t");
+			if (t.size() == 0) continue;
+			if (t[0] == "nrecords") {
+				NRecords = (size_t)std::stoull(t[1]);
+			}
+			else if (t[0] == "field" && t.size() >= 7) {
+				cAsciiColumnField f(fields.size(), startcolumn, t[1], t[2][0], (size_t)std::stoull(t[3]), (size_t)std::stoull(t[4]), (size_t)std::stoull(t[5]));
+				f.startchar = startchar;
+				for (size_t i = 7; i < t.size(); i++) {
+					const size_t eq = t[i].find('=');
+					if (eq != std::string::npos) f.add_att(t[i].substr(0, eq), t[i].substr(eq + 1));
+				}
+				startcolumn += f.nbands;
+				startchar += f.nbands * f.width;
+				FieldOffsets.push_back((size_t)std::stoull(t[6]));
+				fields.push_back(f);
+			}
+			else if (t[0] == "lines" && t.size() >= 3) {
+				NLines = (size_t)std::stoull(t[1]);
+				LineOffset = (size_t)std::stoull(t[2]);
+			}
+			else if (t[0] == "end") break;
+		}
+
+		//Every array must lie inside the data area
+		for (size_t fi = 0; fi < fields.size(); fi++) {
+			const size_t vs = value_size(fields[fi]);
+			bool inside = (vs == 0 || NRecords <= datasize / vs);
+			if (inside) {
+				const size_t bb = band_bytes(fields[fi], NRecords);
+				inside = (bb == 0 || fields[fi].nbands <= datasize / bb) && FieldOffsets[fi] <= datasize - fields[fi].nbands * bb;
+			}
+			if (inside == false) {
+				glog.errormsg(_SRC_, "Field %s extends beyond the end of %s\n", fields[fi].name.c_str(), path.c_str());
+			}
+		}
+		if (NLines > datasize / (3 * sizeof(unsigned int)) || LineOffset > datasize - 3 * NLines * sizeof(unsigned int)) {
+			glog.errormsg(_SRC_, "Line index extends beyond the end of %s\n", path.c_str());
+		}
+
+		if (NLines > 0) {
+			const unsigned int* q = (const unsigned int*)(pData + LineOffset);
+			line_number.assign(q, q + NLines);
+			line_index_start.assign(q + NLines, q + 2 * NLines);
+			line_index_count.assign(q + 2 * NLines, q + 3 * NLines);
+		}
+		return true;
+	};
+
+	void close() {
+		MMF.close();
+		pData = nullptr;
+		NRecords = 0;
+		NLines = 0;
+		LineOffset = 0;
+		FieldOffsets.clear();
+		fields.clear();
+		line_number.clear();
+		line_index_start.clear();
+		line_index_count.clear();
+	};
+
+	size_t nrecords() const { return NRecords; };
+
+	size_t nlines() const { return NLines; };
+
+	int fieldindexbyname(const std::string& fieldname) const {
+		for (size_t fi = 0; fi < fields.size(); fi++) {
+			if (strcasecmp(fields[fi].name, fieldname) == 0) return (int)fi;
+		}
+		return -1;
+	};
+
+	//Pointer to the nrecords() values of a band of an integer field
+	const int32_t* intband(const size_t& findex, const size_t& band = 0) const {
+		check_band(findex, band);
+		return (const int32_t*)(pData + FieldOffsets[findex] + band * band_bytes(fields[findex], NRecords));
+	};
+
+	//Pointer to the nrecords() values of a band of a real field
+	const double* doubleband(const size_t& findex, const size_t& band = 0) const {
+		check_band(findex, band);
+		return (const double*)(pData + FieldOffsets[findex] + band * band_bytes(fields[findex], NRecords));
+	};
+
+	template<typename T>
+	void getfieldbyindex(const size_t& findex, const size_t& record, T& v, const size_t& band = 0) const {
+		const cAsciiColumnField& f = fields[findex];
+		if (f.isinteger()) {
+			const int32_t x = intband(findex, band)[record];
+			v = (x == (int32_t)undefinedvalue<int>()) ? undefinedvalue<T>() : (T)x;
+		}
+		else if (f.ischar()) {
+			std::string msg = _SRC_ + strprint("\n\tField %s is a character field\n", f.name.c_str());
+			throw(std::runtime_error(msg));
+		}
+		else {
+			const double x = doubleband(findex, band)[record];
+			v = (x == undefinedvalue<double>()) ? undefinedvalue<T>() : (T)x;
+		}
+	};
+
+	template<typename T>
+	void getfieldbyindex(const size_t& findex, const size_t& record, std::vector<T>& vec) const {
+		vec.resize(fields[findex].nbands);
+		for (size_t bi = 0; bi < vec.size(); bi++) {
+			getfieldbyindex(findex, record, vec[bi], bi);
+		}
+	};
+
+	//Copies n values of a band starting at record first into out, converting to T and mapping the nulls to undefinedvalue<T>()
+	template<typename T>
+	void getband(const size_t& findex, const size_t& band, const size_t& first, const size_t& n, T* out) const {
+		const cAsciiColumnField& f = fields[findex];
+		if (f.isinteger()) {
+			const int32_t* p = intband(findex, band) + first;
+			const int32_t nv = (int32_t)undefinedvalue<int>();
+			for (size_t i = 0; i < n; i++) out[i] = (p[i] == nv) ? undefinedvalue<T>() : (T)p[i];
+		}
+		else if (f.ischar() == false) {
+			const double* p = doubleband(findex, band) + first;
+			if constexpr (std::is_same<T, double>::value) {
+				std::memcpy(out, p, n * sizeof(double));
+			}
+			else {
+				const double nv = undefinedvalue<double>();
+				for (size_t i = 0; i < n; i++) out[i] = (p[i] == nv) ? undefinedvalue<T>() : (T)p[i];
+			}
+		}
+		else {
+			std::string msg = _SRC_ + strprint("\n\tField %s is a character field\n", f.name.c_str());
+			throw(std::runtime_error(msg));
+		}
+	};
+
+	std::string getstring(const size_t& findex, const size_t& record, const size_t& band = 0) const {
+		check_band(findex, band);
+		const cAsciiColumnField& f = fields[findex];
+		const char* p = pData + FieldOffsets[findex] + band * band_bytes(f, NRecords) + record * f.width;
+		return std::string(p, strnlen(p, f.width));
+	};
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _blockprefetcher_H
+#define _blockprefetcher_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+//Reads a byte source on a background thread into a bounded queue of blocks, so that reading overlaps with the consumer's work.
+//Blocks are cut after the last newline, so a record (line) never straddles two blocks.
+//At most nblocks blocks (including the one held by the consumer) of about blocksize bytes are alive at once.
+class cBlockPrefetcher {
+
+public:
+	//Reads up to n bytes into buf and returns the number read, 0 at the end of the input
+	using ReadFunc = std::function<size_t(char* buf, const size_t n)>;
+
+private:
+	static constexpr char newline = 10;
+
+	ReadFunc Read;
+	size_t BlockSize = 0;
+	size_t NBlocks = 0;
+	size_t NInUse = 0;//Blocks being filled, queued or held by the consumer
+	bool ConsumerHolds = false;
+
+	std::thread Thread;
+	std::mutex Mutex;
+	std::condition_variable CVReady;
+	std::condition_variable CVFree;
+	std::deque<std::vector<char>> Ready;
+	std::vector<std::vector<char>> Free;
+	bool Stop = false;
+	bool Done = false;
+	std::exception_ptr Error;
+
+	bool acquire(std::vector<char>& buf) {
+		std::unique_lock<std::mutex> lock(Mutex);
+		CVFree.wait(lock, [this] { return Stop || NInUse < NBlocks; });
+		if (Stop) return false;
+		if (Free.size() > 0) {
+			buf.swap(Free.back());
+			Free.pop_back();
+		}
+		NInUse++;
+		return true;
+	}
+
+	void publish(std::vector<char>& buf, const bool done) {
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (buf.size() > 0) Ready.push_back(std::move(buf));
+		if (done) Done = true;
+		CVReady.notify_one();
+	}
+
+	void run() {
+		try {
+			std::vector<char> carry;
+			bool endofinput = false;
+			while (endofinput == false) {
+				std::vector<char> buf;
+				if (acquire(buf) == false) return;
+
+				buf.assign(carry.begin(), carry.end());
+				carry.clear();
+
+				//Fill the block, reading on past blocksize only if it does not yet hold a whole line
+				size_t lastnl = std::string::npos;
+				while (true) {
+					const size_t n0 = buf.size();
+					const size_t want = n0 < BlockSize ? BlockSize - n0 : BlockSize;
+					buf.resize(n0 + want);
+					const size_t nread = Read(buf.data() + n0, want);
+					buf.resize(n0 + nread);
+					if (nread == 0) {
+						endofinput = true;
+						break;
+					}
+					for (size_t i = buf.size(); i > n0; i--) {
+						if (buf[i - 1] == newline) {
+							lastnl = i - 1;
+							break;
+						}
+					}
+					if (buf.size() >= BlockSize && lastnl != std::string::npos) break;
+				}
+
+				if (endofinput == false) {
+					carry.assign(buf.begin() + lastnl + 1, buf.end());
+					buf.resize(lastnl + 1);
+				}
+				publish(buf, endofinput);
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(Mutex);
+			Error = std::current_exception();
+			Done = true;
+			CVReady.notify_one();
+		}
+	}
+
+public:
+
+	cBlockPrefetcher() {};
+
+	cBlockPrefetcher(const cBlockPrefetcher&) = delete;
+	cBlockPrefetcher& operator=(const cBlockPrefetcher&) = delete;
+
+	~cBlockPrefetcher() {
+		stop();
+	};
+
+	void start(ReadFunc readfunc, const size_t blocksize, const size_t nblocks = 2) {
+		stop();
+		Read = readfunc;
+		BlockSize = blocksize > 0 ? blocksize : 1;
+		NBlocks = nblocks > 1 ? nblocks : 2;
+		NInUse = 0;
+		ConsumerHolds = false;
+		Stop = false;
+		Done = false;
+		Error = nullptr;
+		Thread = std::thread(&cBlockPrefetcher::run, this);
+	};
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Stop = true;
+			CVFree.notify_all();
+		}
+		if (Thread.joinable()) Thread.join();
+		//Keep the buffers for reuse by the next start()
+		while (Ready.size() > 0) {
+			Free.push_back(std::move(Ready.front()));
+			Ready.pop_front();
+		}
+		Read = nullptr;
+	};
+
+	bool isrunning() const {
+		return Thread.joinable();
+	};
+
+	//Blocks until the next block is ready and swaps it into block, whose old contents are recycled.
+	//Returns false at the end of the input, rethrows any exception raised by the reader.
+	bool next(std::vector<char>& block) {
+		std::unique_lock<std::mutex> lock(Mutex);
+		if (block.capacity() > 0) {
+			block.clear();
+			Free.push_back(std::move(block));
+			block = std::vector<char>();
+		}
+		if (ConsumerHolds) {
+			ConsumerHolds = false;
+			NInUse--;
+			CVFree.notify_one();
+		}
+		CVReady.wait(lock, [this] { return Ready.size() > 0 || Done; });
+		if (Ready.size() == 0) {
+			if (Error) std::rethrow_exception(Error);
+			return false;
+		}
+		block.swap(Ready.front());
+		Ready.pop_front();
+		ConsumerHolds = true;
+		return true;
+	};
+};
+
+#endif
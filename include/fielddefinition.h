@@ -137,11 +137,7 @@ public:
 			throw(std::runtime_error(msg));
 		}
 		else {
-			if (colstrings[columnnumber].size() == 0) {
-				v = undefinedvalue<T>();
-			}
-			else {
-				std::istringstream(colstrings[columnnumber]) >> v;
+			if (field2num(colstrings[columnnumber], v)) {
 				if (flip) apply_flip(v);
 			}
 		}
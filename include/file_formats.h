@@ -181,9 +181,8 @@ public:
 
 	template <typename T>
 	T nullvalue() const {
-		std::stringstream iss(nullstring());
 		T val = 0;
-		iss >> val;
+		str2num_fast(nullstring(), val);
 		return val;
 	}
 
@@ -400,6 +399,138 @@ public:
 	}
 };
 
+//Columnar storage for a group of records (eg a flight line) with one contiguous buffer per selected field.
+//Each buffer holds nrecords()*nbands values in record major order (all bands of record 0, then record 1, ...).
+//Integer fields are stored as int, all other fields as double, and nulls as undefinedvalue<T>().
+//The buffers keep their capacity between groups, so once the largest group has been read no more allocations are made.
+class cColumnarBatch {
+
+public:
+
+	class cColumn {
+	public:
+		size_t findex = 0;//Index of the field in the fields vector
+		size_t startcol = 0;
+		size_t nbands = 0;
+		bool isinteger = false;
+		std::vector<int> ints;
+		std::vector<double> doubles;
+
+		const int* intdata() const { return ints.data(); };
+		const double* doubledata() const { return doubles.data(); };
+
+		template<typename T>
+		T value(const size_t& record, const size_t& band = 0) const {
+			const size_t i = record * nbands + band;
+			if (isinteger) return (T)ints[i];
+			return (T)doubles[i];
+		};
+	};
+
+private:
+	size_t NRecords = 0;
+	std::vector<cColumn> Columns;
+	std::vector<int> FieldColumn;//Index into Columns of each field or -1 if not selected
+
+public:
+
+	cColumnarBatch() {};
+
+	cColumnarBatch(const std::vector<cAsciiColumnField>& fields, const std::vector<size_t>& findices = std::vector<size_t>()) {
+		setup(fields, findices);
+	};
+
+	//Select the fields to be read, all fields if findices is empty
+	void setup(const std::vector<cAsciiColumnField>& fields, const std::vector<size_t>& findices = std::vector<size_t>()) {
+		NRecords = 0;
+		Columns.clear();
+		FieldColumn.assign(fields.size(), -1);
+		const size_t n = findices.size() > 0 ? findices.size() : fields.size();
+		Columns.resize(n);
+		for (size_t k = 0; k < n; k++) {
+			const size_t fi = findices.size() > 0 ? findices[k] : k;
+			const cAsciiColumnField& f = fields[fi];
+			cColumn& c = Columns[k];
+			c.findex = fi;
+			c.startcol = (size_t)f.startcol();
+			c.nbands = f.nbands;
+			c.isinteger = (f.datatype() == cAsciiColumnField::Type::INTEGER);
+			FieldColumn[fi] = (int)k;
+		}
+	};
+
+	bool issetup() const { return FieldColumn.size() > 0; };
+
+	//Empty the batch but keep the buffers' capacity
+	void clear() {
+		NRecords = 0;
+		for (cColumn& c : Columns) {
+			c.ints.clear();
+			c.doubles.clear();
+		}
+	};
+
+	//Reserve for nrecords records per group, eg the maximum of the line index counts
+	void reserve(const size_t& nrecords) {
+		for (cColumn& c : Columns) {
+			if (c.isinteger) c.ints.reserve(nrecords * c.nbands);
+			else c.doubles.reserve(nrecords * c.nbands);
+		}
+	};
+
+	size_t nrecords() const { return NRecords; };
+
+	size_t ncolumns() const { return Columns.size(); };
+
+	const cColumn& column(const size_t& k) const { return Columns[k]; };
+
+	bool hasfield(const size_t& findex) const {
+		return findex < FieldColumn.size() && FieldColumn[findex] >= 0;
+	};
+
+	const cColumn& field(const size_t& findex) const {
+		if (hasfield(findex) == false) {
+			std::string msg = _SRC_ + strprint("\n\tField %zu has not been selected in the batch\n", findex);
+			throw(std::runtime_error(msg));
+		}
+		return Columns[(size_t)FieldColumn[findex]];
+	};
+
+	//Append one record by converting its (trimmed, null mapped to empty) column strings straight into the buffers.
+	//The caller must ensure colviews has all the columns of the selected fields.
+	void append(const std::vector<std::string_view>& colviews) {
+		for (cColumn& c : Columns) {
+			if (c.isinteger) {
+				const size_t n = c.ints.size();
+				c.ints.resize(n + c.nbands);
+				int* p = c.ints.data() + n;
+				for (size_t bi = 0; bi < c.nbands; bi++) field2num(colviews[c.startcol + bi], p[bi]);
+			}
+			else {
+				const size_t n = c.doubles.size();
+				c.doubles.resize(n + c.nbands);
+				double* p = c.doubles.data() + n;
+				for (size_t bi = 0; bi < c.nbands; bi++) field2num(colviews[c.startcol + bi], p[bi]);
+			}
+		}
+		NRecords++;
+	};
+
+	//Copy into the per field vector-of-vectors layout, reusing the capacity of the inner vectors
+	void copy_to(std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& doublefields) const {
+		intfields.resize(FieldColumn.size());
+		doublefields.resize(FieldColumn.size());
+		for (size_t fi = 0; fi < FieldColumn.size(); fi++) {
+			intfields[fi].clear();
+			doublefields[fi].clear();
+		}
+		for (const cColumn& c : Columns) {
+			if (c.isinteger) intfields[c.findex].assign(c.ints.begin(), c.ints.end());
+			else doublefields[c.findex].assign(c.doubles.begin(), c.doubles.end());
+		}
+	};
+};
+
 class cOutputFileInfo {
 
 	size_t lastfield = 0;
@@ -1016,10 +1147,15 @@ public:
 class cColumnFile {
 
 private:
+	static constexpr std::string_view delimiters = " ,\t\r\n";
 	std::ifstream file;
-	std::string currentrecord;
-	std::vector<std::string> currentcolumns;
+	cLineReader reader;
+	std::string_view record;//View into the reader's buffer
+	mutable std::string currentrecord;//Only materialised on request
+	std::vector<std::string_view> currentcolumns;
 	size_t recordsreadsuccessfully;
+	bool endoffile = false;
+	cColumnarBatch groupbatch;//Reused by readnextgroup
 
 public:
 
@@ -1040,6 +1176,10 @@ public:
 
 	void initialise() {
 		recordsreadsuccessfully = 0;
+		endoffile = false;
+		record = std::string_view();
+		currentcolumns.clear();
+		groupbatch = cColumnarBatch();
 	};
 
 	const cAsciiColumnField& fields(const size_t fi) {
@@ -1054,15 +1194,25 @@ public:
 		return F.ncolumns();
 	}
 
-	const char* currentrecord_cstr() { return currentrecord.c_str(); };
+	const char* currentrecord_cstr() { return currentrecordstring().c_str(); };
+
+	const std::string& currentrecordstring() {
+		currentrecord.assign(record.data(), record.size());
+		return currentrecord;
+	};
 
-	const std::string& currentrecordstring() { return currentrecord; };
+	std::string_view currentrecordview() const { return record; };
 
 	bool openread(const std::string& datafilename) {
 		std::string path = datafilename;
 		fixseparator(path);
-		file.open(path, std::fstream::in);
-		if (file.is_open())return true;
+		//Binary so that the reader sees the bytes, it drops the "\r" of "\r\n" line endings itself
+		file.open(path, std::fstream::in | std::fstream::binary);
+		if (file.is_open()) {
+			initialise();
+			reader.attach(file);
+			return true;
+		}
 		else {
 			std::string msg = _SRC_ + strprint("Could not open file (%s)\n", path.c_str());
 			throw(std::runtime_error(msg));
@@ -1073,89 +1223,79 @@ public:
 	void close() { file.close(); };
 
 	bool readnextrecord() {
-		if (file.eof())return false;
-		std::getline(file, currentrecord);
+		if (reader.next(record) == false) {
+			endoffile = true;
+			return false;
+		}
 		recordsreadsuccessfully++;
 		return true;
 	}
 
 	size_t parse_record() {
-		currentcolumns = parsestrings(currentrecord, " ,\t\r\n");
-		return currentcolumns.size();
+		return tokenise_view(record, delimiters, currentcolumns);
 	}
 
 	bool getcolumn(const size_t columnnumber, int& v) {
-		v = atoi(currentcolumns[columnnumber].c_str());
+		str2num_fast(currentcolumns[columnnumber], v);
 		return true;
 	}
 
 	bool getcolumn(const size_t columnnumber, double& v) {
-		v = atof(currentcolumns[columnnumber].c_str());
+		str2num_fast(currentcolumns[columnnumber], v);
 		return true;
 	}
 
 	bool getfield(const size_t findex, int& v) {
-		size_t base = fields(findex).startcol();
-		v = atoi(currentcolumns[base].c_str());
-		return true;
+		return getcolumn(fields(findex).startcol(), v);
 	}
 
 	bool getfield(const size_t findex, double& v) {
-		size_t base = fields(findex).startcol();
-		v = atof(currentcolumns[base].c_str());
-		return true;
+		return getcolumn(fields(findex).startcol(), v);
 	}
 
 	bool getfield(const size_t findex, std::vector<int>& v) {
-		size_t base = fields(findex).startcol();
-		size_t nb = fields(findex).nbands;
+		const size_t base = fields(findex).startcol();
+		const size_t nb = fields(findex).nbands;
 		v.resize(nb);
 		for (size_t bi = 0; bi < nb; bi++) {
-			v[bi] = atoi(currentcolumns[base].c_str());
-			base++;
+			str2num_fast(currentcolumns[base + bi], v[bi]);
 		}
 		return true;
 	}
 
 	bool getfield(const size_t findex, std::vector<double>& v) {
-		size_t base = fields(findex).startcol();
-		size_t nb = fields(findex).nbands;
+		const size_t base = fields(findex).startcol();
+		const size_t nb = fields(findex).nbands;
 		v.resize(nb);
 		for (size_t bi = 0; bi < nb; bi++) {
-			v[bi] = atof(currentcolumns[base].c_str());
-			base++;
+			str2num_fast(currentcolumns[base + bi], v[bi]);
 		}
 		return true;
 	}
 
 	bool getfieldlog10(const size_t findex, std::vector<double>& v) {
-		size_t base = fields(findex).startcol();
-		size_t nb = fields(findex).nbands;
-
-		v.resize(nb);
-		for (size_t bi = 0; bi < nb; bi++) {
-			v[bi] = atof(currentcolumns[base].c_str());
+		getfield(findex, v);
+		for (size_t bi = 0; bi < v.size(); bi++) {
 			if (fields(findex).isnull(v[bi]) == false) {
 				v[bi] = log10(v[bi]);
 			}
-			base++;
 		}
 		return true;
 	}
 
-	size_t readnextgroup(const size_t fgroupindex, std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& doublefields) {
-
-		if (file.eof())return 0;
+	//Reads the records of the next group (consecutive records with the same value of field fgroupindex) into batch,
+	//whose buffers are reused between groups. If the batch has not been setup all fields are selected.
+	size_t readnextgroup(const size_t fgroupindex, cColumnarBatch& batch) {
 
-		intfields.clear();
-		doublefields.clear();
-		intfields.resize(nfields());
-		doublefields.resize(nfields());
+		if (batch.issetup() == false) batch.setup(F.fields);
+		batch.clear();
+		if (endoffile) return 0;
 
 		int lastline;
 		size_t count = 0;
+		//Leave the last read record (from the next group) up the spout for next time
 		do {
-			if (recordsreadsuccessfully == 0) readnextrecord();
+			if (recordsreadsuccessfully == 0 && readnextrecord() == false) break;
 			if (parse_record() != ncolumns()) {
 				continue;
 			}
@@ -1168,27 +1308,19 @@ public:
 				return count;
 			}
 
-			for (size_t fi = 0; fi < nfields(); fi++) {
-				size_t nbands = fields(fi).nbands;
-				if (fields(fi).datatype() == cAsciiColumnField::Type::INTEGER) {
-					std::vector<int> v;
-					getfield(fi, v);
-					for (size_t bi = 0; bi < nbands; bi++) {
-						intfields[fi].push_back(v[bi]);
-					}
-				}
-				else {
-					std::vector<double> v;
-					getfield(fi, v);
-					for (size_t bi = 0; bi < nbands; bi++) {
-						doublefields[fi].push_back(v[bi]);
-					}
-				}
-			}
+			batch.append(currentcolumns);
 			count++;
 		} while (readnextrecord());
 		return count;
 	};
+
+	size_t readnextgroup(const size_t fgroupindex, std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& doublefields) {
+		if (endoffile) return 0;
+		if (groupbatch.ncolumns() != nfields()) groupbatch.setup(F.fields);
+		const size_t count = readnextgroup(fgroupindex, groupbatch);
+		groupbatch.copy_to(intfields, doublefields);
+		return count;
+	};
 };
 
 #endif
@@ -12,12 +12,29 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <filesystem>
 #include <cstdlib>
 #include <cstdio>
 #include <cstdarg>
 #include <cerrno>
 #include <vector>
+#include <string_view>
+#include <istream>
 #include <cstring>
+#include <thread>
+#include <algorithm>
+
+#if defined __AVX2__
+#include <immintrin.h>
+#endif
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define _file_utils_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
 
 #if defined _WIN32
 #include <io.h>
@@ -605,6 +622,203 @@ inline bool filegetline(FILE* fp, std::string& str)
 	return false;
 }
 
+//Writes a sidecar/cache file by calling writer(ofs) on a temporary file which is then renamed to path,
+//so that a reader never sees a partially written file. The temporary file is removed on failure.
+template<typename WriterFunc>
+inline bool write_sidecar_atomically(const std::string& path, WriterFunc writer, const std::ios::openmode mode = std::ios::out)
+{
+	const std::string tmppath = path + ".tmp";
+	std::error_code ec;
+	{
+		std::ofstream ofs(tmppath, mode | std::ios::out | std::ios::trunc);
+		if (ofs) {
+			writer(ofs);
+			ofs.close();
+		}
+		if (ofs) std::filesystem::rename(tmppath, path, ec);
+		if (ofs && !ec) return true;
+	}
+	std::filesystem::remove(tmppath, ec);
+	return false;
+}
+
+inline int lowestsetbit32(const uint32_t v)//v must be non zero
+{
+#if defined __GNUC__ || defined __clang__
+	return __builtin_ctz(v);
+#elif defined _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, v);
+	return (int)i;
+#else
+	int i = 0;
+	while (((v >> i) & 1) == 0) i++;
+	return i;
+#endif
+}
+
+//Pointer to the first occurrence of c in [p, end), or end if there is none (AVX2/SSE2 when available)
+inline const char* findchar(const char* p, const char* end, const char c)
+{
+#if defined __AVX2__
+	const __m256i c32 = _mm256_set1_epi8(c);
+	while (end - p >= 32) {
+		const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+		const uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c32));
+		if (mask) return p + lowestsetbit32(mask);
+		p += 32;
+	}
+#endif
+#if defined _file_utils_SSE2
+	const __m128i c16 = _mm_set1_epi8(c);
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)p);
+		const uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c16));
+		if (mask) return p + lowestsetbit32(mask);
+		p += 16;
+	}
+#endif
+	if (p >= end) return end;
+	const char* q = (const char*)std::memchr(p, c, (size_t)(end - p));
+	return q ? q : end;
+}
+
+//Number of occurrences of c in [p, end) (AVX2/SSE2 when available)
+inline size_t countchar(const char* p, const char* end, const char c)
+{
+	//Matches are accumulated in byte counters (cmpeq gives -1 per match) for up to 255 blocks, then summed with sad
+	size_t n = 0;
+#if defined __AVX2__
+	const __m256i c32 = _mm256_set1_epi8(c);
+	while (end - p >= 32) {
+		__m256i acc = _mm256_setzero_si256();
+		const size_t nblocks = std::min((size_t)255, (size_t)(end - p) / 32);
+		for (size_t k = 0; k < nblocks; k++) {
+			const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, c32));
+			p += 32;
+		}
+		const __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+		const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		n += (size_t)_mm_cvtsi128_si32(s) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+	}
+#endif
+#if defined _file_utils_SSE2
+	const __m128i c16 = _mm_set1_epi8(c);
+	while (end - p >= 16) {
+		__m128i acc = _mm_setzero_si128();
+		const size_t nblocks = std::min((size_t)255, (size_t)(end - p) / 16);
+		for (size_t k = 0; k < nblocks; k++) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)p);
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, c16));
+			p += 16;
+		}
+		const __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+		n += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+	}
+#endif
+	while (p < end) {
+		if (*p == c) n++;
+		p++;
+	}
+	return n;
+}
+
+//Reads the lines of a stream a block at a time, each line is returned as a view into the block (without the "\n" or a "\r" before it).
+//A view is valid until the next call to next().
+class cLineReader {
+
+	std::istream* In = nullptr;
+	std::vector<char> Buf;
+	size_t Pos = 0;
+	size_t End = 0;
+	size_t BlockSize = 0;
+	bool InputDone = true;
+
+	static std::string_view chomp(const char* p, size_t n) {
+		if (n > 0 && p[n - 1] == '\r') n--;
+		return std::string_view(p, n);
+	}
+
+public:
+
+	cLineReader(const size_t blocksize = 1048576) {
+		BlockSize = std::max((size_t)1, blocksize);
+	};
+
+	cLineReader(std::istream& in, const size_t blocksize = 1048576) : cLineReader(blocksize) {
+		attach(in);
+	};
+
+	void attach(std::istream& in) {
+		In = &in;
+		Pos = End = 0;
+		InputDone = false;
+	};
+
+	//Discard any buffered lines, eg after the stream has been repositioned
+	void reset() {
+		Pos = End = 0;
+		InputDone = (In == nullptr);
+	};
+
+	bool next(std::string_view& line) {
+		while (true) {
+			const char* begin = Buf.data() + Pos;
+			const char* end = Buf.data() + End;
+			const char* nl = findchar(begin, end, '\n');
+			if (nl != end) {
+				line = chomp(begin, (size_t)(nl - begin));
+				Pos = (size_t)(nl - Buf.data()) + 1;
+				return true;
+			}
+			if (InputDone) {
+				if (Pos < End) {
+					line = chomp(begin, End - Pos);
+					Pos = End;
+					return true;
+				}
+				line = std::string_view();
+				return false;
+			}
+			//Move the partial line to the front and read the next block after it
+			if (End > Pos) std::memmove(Buf.data(), begin, End - Pos);
+			End -= Pos;
+			Pos = 0;
+			if (Buf.size() < End + BlockSize) Buf.resize(End + BlockSize);
+			In->read(Buf.data() + End, (std::streamsize)BlockSize);
+			const size_t nread = (size_t)In->gcount();
+			End += nread;
+			if (nread == 0) InputDone = true;
+		}
+	};
+
+	bool eof() const {
+		return InputDone && Pos >= End;
+	};
+};
+
+//Number of newlines in bytes [offset, offset + length) of the file
+inline size_t countlines(const std::string filename, const int64_t offset, const int64_t length)
+{
+	std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+	if (!ifs) return 0;
+	ifs.seekg((std::streamoff)offset, std::ios::beg);
+	const size_t buffersize = 4194304;
+	std::vector<char> buffer(buffersize);
+	size_t n = 0;
+	int64_t remaining = length;
+	while (remaining > 0) {
+		const size_t want = (size_t)std::min((int64_t)buffersize, remaining);
+		ifs.read(buffer.data(), (std::streamsize)want);
+		const size_t nread = (size_t)ifs.gcount();
+		if (nread == 0) break;
+		n += countchar(buffer.data(), buffer.data() + nread, '\n');
+		remaining -= (int64_t)nread;
+	}
+	return n;
+}
+
 inline size_t countlines(const std::string filename)
 {
 	FILE* fp = fopen(filename.c_str(), "rb");
@@ -614,14 +828,38 @@ inline size_t countlines(const std::string filename)
 	size_t nread = 0;
 	do {
 		nread = fread(buffer.data(), 1, buffersize, fp);
-		for (size_t k = 0; k < nread; k++) {
-			if (buffer[k] == '\n')n++;
-		}
+		n += countchar(buffer.data(), buffer.data() + nread, '\n');
 	} while (nread > 0);
 	fclose(fp);
 	return n;
 }
 
+//As countlines but the file is split into nthreads byte ranges counted concurrently (0 = all hardware threads)
+inline size_t countlines_parallel(const std::string filename, size_t nthreads = 0)
+{
+	const int64_t size = filesize(filename);
+	if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+	const int64_t minbytes = 16777216;//Not worth a thread for less
+	nthreads = (size_t)std::max((int64_t)1, std::min((int64_t)nthreads, size / minbytes));
+	if (nthreads == 1) return countlines(filename, 0, size);
+
+	std::vector<size_t> counts(nthreads, 0);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < nthreads; t++) {
+		const int64_t b1 = (size * (int64_t)t) / (int64_t)nthreads;
+		const int64_t b2 = (size * (int64_t)(t + 1)) / (int64_t)nthreads;
+		threads.emplace_back([&counts, &filename, t, b1, b2]() {
+			counts[t] = countlines(filename, b1, b2 - b1);
+		});
+	}
+	size_t n = 0;
+	for (size_t t = 0; t < nthreads; t++) {
+		threads[t].join();
+		n += counts[t];
+	}
+	return n;
+}
+
 inline size_t countlines1(const std::string filename)
 {
 	size_t n = 0;
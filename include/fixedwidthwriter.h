@@ -0,0 +1,489 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _fixedwidthwriter_H
+#define _fixedwidthwriter_H
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <charconv>
+#include <string>
+#include <vector>
+#include <variant>
+#include <thread>
+#include <type_traits>
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "file_formats.h"
+#include "undefinedvalues.h"
+
+#ifdef ENABLE_MPI
+#include "mpi_wrapper.h"
+#endif
+
+//Writes fixed width records formatted by the fields of a cOutputFileInfo (I, F, E and A formats of the given width, decimals and nbands).
+//Values are formatted with std::to_chars straight into a reusable buffer rather than with a fprintf per value.
+//Undefined values (undefinedvalue<T>() or NaN) are written as the field's null string if it has one.
+//A value too wide for its field is written as width '*'s so that every record has the same length (record_length()).
+//Records can be written one value at a time (add/endrecord) or in batches from typed arrays (setsource/write_records),
+//which are formatted on several threads, each into its own records of the buffer, so the order is preserved.
+class cFixedWidthWriter {
+
+	enum class KIND { INTEGER, FIXED, EXPONENT, CHAR };
+
+	struct cColumnFormat {
+		KIND kind = KIND::FIXED;
+		size_t width = 0;
+		int decimals = 0;
+		size_t offset = 0;//Character offset in the record
+		bool hasnull = false;
+		std::string nullstring;
+	};
+
+	using Source = std::variant<std::monostate, const int*, const size_t*, const float*, const double*, const std::string*>;
+
+	std::vector<cAsciiColumnField> Fields;
+	std::vector<cColumnFormat> Columns;
+	std::vector<Source> Sources;
+	size_t RecordLength = 0;//Including the newline
+
+	FILE* fp = nullptr;
+	std::string Path;
+	std::vector<char> Buffer;
+	size_t BufferRecords = 0;//Records that fit in the buffer
+	size_t BufferPos = 0;
+	size_t Column = 0;//Next column of the record being added
+	size_t NWritten = 0;
+	size_t NOverflows = 0;
+
+	template<typename T>
+	static bool isnull(const T& v) {
+		if constexpr (std::is_floating_point<T>::value) {
+			if (std::isnan(v)) return true;
+		}
+		if constexpr (std::is_same<T, short>::value || std::is_same<T, int>::value || std::is_same<T, size_t>::value || std::is_same<T, float>::value || std::is_same<T, double>::value) {
+			return v == undefinedvalue<T>();
+		}
+		return false;
+	}
+
+	//Right justifies [s, s + n) in the column, or fills it with '*' if it does not fit
+	static bool justify(char* out, const cColumnFormat& c, const char* s, const size_t n) {
+		if (n > c.width) {
+			std::memset(out, '*', c.width);
+			return false;
+		}
+		std::memset(out, ' ', c.width - n);
+		std::memcpy(out + c.width - n, s, n);
+		return true;
+	}
+
+	template<typename T>
+	static bool format(char* out, const cColumnFormat& c, const T& v) {
+		if (c.hasnull && isnull(v)) {
+			return justify(out, c, c.nullstring.data(), c.nullstring.size());
+		}
+		if constexpr (std::is_same<T, std::string>::value) {
+			return justify(out, c, v.data(), v.size());
+		}
+		else {
+			char tmp[512];
+			std::to_chars_result r;
+			r.ec = std::errc();
+			if (c.kind == KIND::INTEGER || c.kind == KIND::CHAR) {
+				if constexpr (std::is_integral<T>::value) {
+					r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+				}
+				else {
+					if (std::isfinite((double)v) == false || std::fabs((double)v) > 9.2e18) {
+						r.ec = std::errc::value_too_large;
+					}
+					else {
+						r = std::to_chars(tmp, tmp + sizeof(tmp), (long long)std::llround((double)v));
+					}
+				}
+			}
+			else if (c.kind == KIND::FIXED) {
+				r = std::to_chars(tmp, tmp + sizeof(tmp), (double)v, std::chars_format::fixed, c.decimals);
+			}
+			else {
+				r = std::to_chars(tmp, tmp + sizeof(tmp), (double)v, std::chars_format::scientific, c.decimals);
+				for (char* p = tmp; p < r.ptr; p++) {
+					if (*p == 'e') *p = 'E';
+				}
+			}
+			if (r.ec != std::errc()) {
+				std::memset(out, '*', c.width);
+				return false;
+			}
+			return justify(out, c, tmp, (size_t)(r.ptr - tmp));
+		}
+	}
+
+	void flushbuffer() {
+		if (BufferPos == 0) return;
+		if (fp == nullptr) {
+			glog.errormsg(_SRC_, "No output file is open\n");
+		}
+		if (std::fwrite(Buffer.data(), 1, BufferPos, fp) != BufferPos) {
+			glog.errormsg(_SRC_, "Error writing to file %s\n", Path.c_str());
+		}
+		BufferPos = 0;
+	}
+
+	template<typename T>
+	bool format_source(char* out, const cColumnFormat& c, const T* data, const size_t& index) const {
+		return format(out, c, data[index]);
+	}
+
+public:
+
+	cFixedWidthWriter(const cOutputFileInfo& oi, const size_t buffersize = 16777216) {
+		setfields(oi.fields, buffersize);
+	};
+
+	cFixedWidthWriter(const std::vector<cAsciiColumnField>& fields, const size_t buffersize = 16777216) {
+		setfields(fields, buffersize);
+	};
+
+	cFixedWidthWriter(const cFixedWidthWriter&) = delete;
+	cFixedWidthWriter& operator=(const cFixedWidthWriter&) = delete;
+
+	~cFixedWidthWriter() {
+		close();
+	};
+
+	void setfields(const std::vector<cAsciiColumnField>& fields, const size_t buffersize = 16777216) {
+		Fields = fields;
+		Columns.clear();
+		size_t offset = 0;
+		for (const cAsciiColumnField& f : Fields) {
+			cColumnFormat c;
+			switch (std::toupper(f.fmtchar)) {
+			case 'I': c.kind = KIND::INTEGER; break;
+			case 'E': c.kind = KIND::EXPONENT; break;
+			case 'A': c.kind = KIND::CHAR; break;
+			default: c.kind = KIND::FIXED; break;
+			}
+			c.width = f.width;
+			c.decimals = (int)f.decimals;
+			c.hasnull = f.hasnullvalue();
+			c.nullstring = f.nullstring();
+			for (size_t bi = 0; bi < f.nbands; bi++) {
+				c.offset = offset;
+				Columns.push_back(c);
+				offset += c.width;
+			}
+		}
+		RecordLength = offset + 1;
+		Sources.assign(Fields.size(), Source());
+		BufferRecords = std::max((size_t)1, buffersize / RecordLength);
+		Buffer.resize(BufferRecords * RecordLength);
+		BufferPos = 0;
+		Column = 0;
+	}
+
+	//Characters per record including the newline
+	size_t record_length() const { return RecordLength; };
+
+	size_t ncolumns() const { return Columns.size(); };
+
+	size_t nrecords_written() const { return NWritten; };
+
+	//Number of values so far that did not fit their field width and were written as '*'s
+	size_t noverflows() const { return NOverflows; };
+
+	bool open(const std::string& path, const bool append = false) {
+		close();
+		Path = path;
+		fp = fileopen(path, append ? "ab" : "wb");
+		if (fp == nullptr) {
+			glog.errormsg(_SRC_, "Could not open file %s\n", path.c_str());
+		}
+		NWritten = 0;
+		return true;
+	};
+
+	void flush() {
+		flushbuffer();
+		if (fp) std::fflush(fp);
+	};
+
+	void close() {
+		if (fp == nullptr) return;
+		if (Column != 0) {
+			glog.warningmsg(_SRC_, "The last record of %s was incomplete and was not written\n", Path.c_str());
+			Column = 0;
+		}
+		flushbuffer();
+		std::fclose(fp);
+		fp = nullptr;
+	};
+
+	//Adds the next value of the record being built
+	template<typename T>
+	void add(const T& v) {
+		if (Column >= Columns.size()) {
+			glog.errormsg(_SRC_, "Record has more than the %zu columns defined\n", Columns.size());
+		}
+		if (Column == 0 && BufferPos + RecordLength > Buffer.size()) flushbuffer();
+		const cColumnFormat& c = Columns[Column];
+		if (format(Buffer.data() + BufferPos + c.offset, c, v) == false) NOverflows++;
+		Column++;
+	};
+
+	template<typename T>
+	void add(const T* v, const size_t n) {
+		for (size_t i = 0; i < n; i++) add(v[i]);
+	};
+
+	template<typename T>
+	void add(const std::vector<T>& v) {
+		add(v.data(), v.size());
+	};
+
+	void endrecord() {
+		if (Column != Columns.size()) {
+			glog.errormsg(_SRC_, "Record has %zu of the %zu columns defined\n", Column, Columns.size());
+		}
+		Buffer[BufferPos + RecordLength - 1] = '\n';
+		BufferPos += RecordLength;
+		Column = 0;
+		NWritten++;
+	};
+
+	//Formats v as column c into its place in the record starting at rec, returns false if it did not fit
+	template<typename T>
+	bool format_column(const size_t c, const T& v, char* rec) const {
+		return format(rec + Columns[c].offset, Columns[c], v);
+	};
+
+	//Sets the array that field findex is taken from by write_records and format_records.
+	//It has nbands values per record, record after record. Supported types are int, size_t, float, double and std::string.
+	template<typename T>
+	void setsource(const size_t findex, const T* data) {
+		if (findex >= Sources.size()) {
+			glog.errormsg(_SRC_, "Field index %zu is out of range\n", findex);
+		}
+		Sources[findex] = data;
+	};
+
+	//Formats the records [first, first + n) of the sources into out (n * record_length() characters) on nthreads threads
+	void format_records(const size_t first, const size_t n, char* out, size_t nthreads = 1) {
+		for (size_t fi = 0; fi < Sources.size(); fi++) {
+			if (std::holds_alternative<std::monostate>(Sources[fi])) {
+				glog.errormsg(_SRC_, "No source has been set for field %s\n", Fields[fi].name.c_str());
+			}
+		}
+		if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+		const size_t minrecords = 4096;//Not worth a thread for fewer
+		nthreads = std::max((size_t)1, std::min(nthreads, n / minrecords));
+
+		std::vector<size_t> overflows(nthreads, 0);
+		auto work = [&](const size_t ti) {
+			const size_t r1 = first + (n * ti) / nthreads;
+			const size_t r2 = first + (n * (ti + 1)) / nthreads;
+			for (size_t r = r1; r < r2; r++) {
+				char* rec = out + (r - first) * RecordLength;
+				size_t c = 0;
+				for (size_t fi = 0; fi < Fields.size(); fi++) {
+					const size_t nb = Fields[fi].nbands;
+					std::visit([&](auto data) {
+						if constexpr (std::is_same<decltype(data), std::monostate>::value == false) {
+							for (size_t bi = 0; bi < nb; bi++) {
+								const cColumnFormat& cf = Columns[c + bi];
+								if (format_source(rec + cf.offset, cf, data, r * nb + bi) == false) overflows[ti]++;
+							}
+						}
+					}, Sources[fi]);
+					c += nb;
+				}
+				rec[RecordLength - 1] = '\n';
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t ti = 1; ti < nthreads; ti++) threads.emplace_back(work, ti);
+		work(0);
+		for (auto& t : threads) t.join();
+		for (size_t k : overflows) NOverflows += k;
+	};
+
+	//Formats and writes the records [0, n) of the sources, a buffer full at a time
+	void write_records(const size_t n, const size_t nthreads = 1) {
+		if (Column != 0) {
+			glog.errormsg(_SRC_, "A record is part way through being added\n");
+		}
+		size_t r = 0;
+		while (r < n) {
+			if (BufferPos + RecordLength > Buffer.size()) flushbuffer();
+			const size_t nr = std::min(n - r, (Buffer.size() - BufferPos) / RecordLength);
+			format_records(r, nr, Buffer.data() + BufferPos, nthreads);
+			BufferPos += nr * RecordLength;
+			r += nr;
+		}
+		NWritten += n;
+	};
+};
+
+#ifdef ENABLE_MPI
+//Writes the records of all the ranks of comm into one shared fixed width file with MPI-IO.
+//As every record is record_length() characters long record r is at byte offset r * record_length(),
+//so each rank writes its own records in place and the file is in record order with no merging afterwards.
+class cMpiFixedWidthWriter {
+
+	static constexpr size_t MaxWriteBytes = 1073741824;//MPI counts are int
+
+	cFixedWidthWriter Formatter;
+	cMpiComm Comm;
+	MPI_File fh;
+	bool isopen = false;
+	std::string Path;
+	std::vector<char> Buffer;//Records added one at a time and not yet flushed
+	std::vector<size_t> RecordIndices;//Their record numbers in the file
+	std::vector<char> BatchBuffer;
+	size_t Column = 0;
+	size_t NOverflows = 0;
+
+	bool chkerr(const int ierr, const char* what) {
+		if (ierr == MPI_SUCCESS) return true;
+		char msg[MPI_MAX_ERROR_STRING];
+		int len = 0;
+		MPI_Error_string(ierr, msg, &len);
+		glog.errormsg(_SRC_, "%s failed for file %s: %s\n", what, Path.c_str(), std::string(msg, (size_t)len).c_str());
+		return false;
+	}
+
+public:
+
+	cMpiFixedWidthWriter(const cOutputFileInfo& oi, cMpiComm comm = cMpiComm(cMpiEnv::world_comm()))
+		: Formatter(oi.fields, 0), Comm(comm) {};
+
+	cMpiFixedWidthWriter(const cMpiFixedWidthWriter&) = delete;
+	cMpiFixedWidthWriter& operator=(const cMpiFixedWidthWriter&) = delete;
+
+	~cMpiFixedWidthWriter() {
+		close();
+	};
+
+	size_t record_length() const { return Formatter.record_length(); };
+
+	size_t noverflows() const { return NOverflows + Formatter.noverflows(); };
+
+	//Collective, any existing file is replaced
+	bool open(const std::string& path) {
+		close();
+		Path = path;
+		fixseparator(Path);
+		if (Comm.rank() == 0) {
+			MPI_File_delete(Path.c_str(), MPI_INFO_NULL);//Not an error if it does not exist
+		}
+		Comm.barrier();
+		const int ierr = MPI_File_open(Comm, Path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+		isopen = chkerr(ierr, "MPI_File_open");
+		return isopen;
+	};
+
+	//Collective
+	void close() {
+		if (isopen == false) return;
+		if (Column != 0) {
+			glog.warningmsg(_SRC_, "The last record of %s was incomplete and was not written\n", Path.c_str());
+			Buffer.resize(RecordIndices.size() * record_length());
+			Column = 0;
+		}
+		flush();
+		MPI_File_close(&fh);
+		isopen = false;
+	};
+
+	template<typename T>
+	void setsource(const size_t findex, const T* data) {
+		Formatter.setsource(findex, data);
+	};
+
+	//Collective, every rank must call it (with n = 0 if it has nothing to write).
+	//Formats this rank's n records from the sources (indexed from 0) on nthreads threads
+	//and writes them as the records [firstrecord, firstrecord + n) of the file with MPI_File_write_at_all.
+	void write_records(const size_t firstrecord, const size_t n, const size_t nthreads = 1) {
+		const size_t rl = record_length();
+		const size_t perwrite = std::max((size_t)1, MaxWriteBytes / rl);
+		size_t nwrites = (n + perwrite - 1) / perwrite;
+		nwrites = Comm.max(nwrites);//Each rank must make the same number of collective calls
+
+		for (size_t k = 0; k < nwrites; k++) {
+			const size_t r1 = std::min(n, k * perwrite);
+			const size_t nr = std::min(n - r1, perwrite);
+			BatchBuffer.resize(nr * rl);
+			if (nr > 0) Formatter.format_records(r1, nr, BatchBuffer.data(), nthreads);
+			const MPI_Offset offset = (MPI_Offset)((firstrecord + r1) * rl);
+			MPI_Status status;
+			const int ierr = MPI_File_write_at_all(fh, offset, BatchBuffer.data(), (int)BatchBuffer.size(), MPI_CHAR, &status);
+			chkerr(ierr, "MPI_File_write_at_all");
+		}
+	};
+
+	//Adds the next value of the record being built
+	template<typename T>
+	void add(const T& v) {
+		if (Column >= Formatter.ncolumns()) {
+			glog.errormsg(_SRC_, "Record has more than the %zu columns defined\n", Formatter.ncolumns());
+		}
+		if (Column == 0) Buffer.resize(Buffer.size() + record_length());
+		char* rec = Buffer.data() + Buffer.size() - record_length();
+		if (Formatter.format_column(Column, v, rec) == false) NOverflows++;
+		Column++;
+	};
+
+	template<typename T>
+	void add(const T* v, const size_t n) {
+		for (size_t i = 0; i < n; i++) add(v[i]);
+	};
+
+	template<typename T>
+	void add(const std::vector<T>& v) {
+		add(v.data(), v.size());
+	};
+
+	//Ends the record being built, which is record recordindex of the file.
+	//These records are buffered and written independently (MPI_File_write_at) by flush(), runs of consecutive records in one write.
+	void endrecord(const size_t recordindex) {
+		if (Column != Formatter.ncolumns()) {
+			glog.errormsg(_SRC_, "Record has %zu of the %zu columns defined\n", Column, Formatter.ncolumns());
+		}
+		Buffer.back() = '\n';
+		RecordIndices.push_back(recordindex);
+		Column = 0;
+		if (Buffer.size() >= 16777216) flush();
+	};
+
+	//Writes the records added with add/endrecord, not collective
+	void flush() {
+		if (Column != 0) {
+			glog.errormsg(_SRC_, "A record is part way through being added\n");
+		}
+		const size_t rl = record_length();
+		size_t i = 0;
+		while (i < RecordIndices.size()) {
+			size_t j = i + 1;
+			while (j < RecordIndices.size() && RecordIndices[j] == RecordIndices[j - 1] + 1 && (j - i + 1) * rl <= MaxWriteBytes) j++;
+			const MPI_Offset offset = (MPI_Offset)(RecordIndices[i] * rl);
+			MPI_Status status;
+			const int ierr = MPI_File_write_at(fh, offset, Buffer.data() + i * rl, (int)((j - i) * rl), MPI_CHAR, &status);
+			chkerr(ierr, "MPI_File_write_at");
+			i = j;
+		}
+		RecordIndices.clear();
+		Buffer.clear();
+	};
+};
+#endif
+
+#endif
@@ -10,6 +10,9 @@ Author: Ross C. Brodie, Geoscience Australia.
 #define _general_types_H
 
 #include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include <complex>
 #include <vector>
 #include <variant>
@@ -379,6 +382,196 @@ public:
 	}
 };
 
+//Accumulates cStats one value at a time (Welford's update) so that partial results, eg from several threads, can be merged
+template<typename T>
+class cStatsAccumulator{
+
+	size_t nulls = 0;
+	size_t n = 0;
+	double min = 0.0;
+	double max = 0.0;
+	double mean = 0.0;
+	double m2 = 0.0;//Sum of squared differences from the mean
+
+public:
+
+	void addnull(){
+		nulls++;
+	}
+
+	void add(const T& value){
+		const double x = (double)value;
+		if (n == 0){
+			min = x;
+			max = x;
+		}
+		else if (x < min) min = x;
+		else if (x > max) max = x;
+		n++;
+		const double d = x - mean;
+		mean += d / (double)n;
+		m2 += d * (x - mean);
+	}
+
+	//Chan et al's pairwise combination
+	void merge(const cStatsAccumulator<T>& b){
+		nulls += b.nulls;
+		if (b.n == 0) return;
+		if (n == 0){
+			const size_t nl = nulls;
+			*this = b;
+			nulls = nl;
+			return;
+		}
+		const double na = (double)n;
+		const double nb = (double)b.n;
+		const double d = b.mean - mean;
+		const double nab = na + nb;
+		mean += d * nb / nab;
+		m2 += b.m2 + d * d * na * nb / nab;
+		if (b.min < min) min = b.min;
+		if (b.max > max) max = b.max;
+		n += b.n;
+	}
+
+	cStats<T> stats() const {
+		cStats<T> s;
+		s.nulls = nulls;
+		s.nonnulls = n;
+		if (n == 0){
+			s.min = s.max = s.mean = s.var = s.std = undefinedvalue<T>();
+			return s;
+		}
+		s.min = (T)min;
+		s.max = (T)max;
+		s.mean = (T)mean;
+		s.var = n > 1 ? (T)(m2 / ((double)n - 1.0)) : (T)0;
+		s.std = (T)sqrt((double)s.var);
+		return s;
+	}
+};
+
+//Histogram of a stream of values whose range is not known in advance, so that it can be built in one pass and merged (eg per thread).
+//The bin width is a power of two and the bin edges are multiples of it, so that two histograms can always be merged exactly.
+//When a value falls outside the nbins bins, adjacent pairs of bins are merged (the width doubled) until it fits.
+template<typename T>
+class cMergeableHistogram{
+
+	size_t nbins = 0;
+	size_t n = 0;
+	int exponent = 0;//Bin width is 2^exponent
+	double invwidth = 1.0;//2^-exponent
+	int64_t first = 0;//Index (value / width) of the first bin
+	int64_t occlo = 0;//Indices of the first and last occupied bins
+	int64_t occhi = 0;
+	std::vector<size_t> counts;
+
+	//floor(k / 2^s) for possibly negative k
+	static int64_t floorshift(const int64_t k, const int s){
+		if (s <= 0) return k;
+		if (s >= 63) return k < 0 ? -1 : 0;
+		return k >= 0 ? (k >> s) : -(((-k - 1) >> s) + 1);
+	}
+
+	int64_t binindex(const double x) const {
+		return (int64_t)std::floor(x * invwidth);
+	}
+
+	//Rebin to width 2^e (>= the current width) with bins lo..hi (at width 2^e) in range, widening further if they do not fit
+	void fit(int e, int64_t lo, int64_t hi){
+		while (hi - lo >= (int64_t)nbins){
+			lo = floorshift(lo, 1);
+			hi = floorshift(hi, 1);
+			e++;
+		}
+		const int64_t f = lo - ((int64_t)nbins - (hi - lo + 1)) / 2;
+		std::vector<size_t> c(nbins, 0);
+		const int s = e - exponent;
+		for (int64_t k = occlo; k <= occhi; k++){
+			const size_t m = counts[(size_t)(k - first)];
+			if (m > 0) c[(size_t)(floorshift(k, s) - f)] += m;
+		}
+		occlo = floorshift(occlo, s);
+		occhi = floorshift(occhi, s);
+		counts.swap(c);
+		exponent = e;
+		invwidth = std::ldexp(1.0, -e);
+		first = f;
+	}
+
+public:
+
+	cMergeableHistogram(const size_t _nbins = 256){
+		nbins = _nbins > 1 ? _nbins : 2;
+		counts.assign(nbins, 0);
+	}
+
+	size_t nsamples() const { return n; };
+
+	T binwidth() const { return (T)std::ldexp(1.0, exponent); };
+
+	void add(const T& value){
+		const double x = (double)value;
+		if (std::isfinite(x) == false) return;
+		if (n == 0){
+			//Start fine, about a millionth of the first value, and let the bins widen to the data
+			exponent = x == 0.0 ? -30 : std::ilogb(x) - 20;
+			invwidth = std::ldexp(1.0, -exponent);
+			occlo = occhi = binindex(x);
+			first = occlo - (int64_t)nbins / 2;
+		}
+		else if (std::fabs(x) * invwidth >= 0x1p60){
+			//Keep the bin indices well inside int64
+			const int e = std::ilogb(x) - 59;
+			fit(e, floorshift(occlo, e - exponent), floorshift(occhi, e - exponent));
+		}
+		int64_t b = binindex(x);
+		if (b < first || b >= first + (int64_t)nbins){
+			fit(exponent, std::min(b, occlo), std::max(b, occhi));
+			b = binindex(x);
+		}
+		if (b < occlo) occlo = b;
+		else if (b > occhi) occhi = b;
+		counts[(size_t)(b - first)]++;
+		n++;
+	}
+
+	void merge(const cMergeableHistogram<T>& b){
+		if (b.n == 0) return;
+		if (n == 0){
+			*this = b;
+			return;
+		}
+		const int e = std::max(exponent, b.exponent);
+		const int64_t lo = std::min(floorshift(occlo, e - exponent), floorshift(b.occlo, e - b.exponent));
+		const int64_t hi = std::max(floorshift(occhi, e - exponent), floorshift(b.occhi, e - b.exponent));
+		fit(e, lo, hi);
+		const int s = exponent - b.exponent;
+		for (int64_t k = b.occlo; k <= b.occhi; k++){
+			const size_t m = b.counts[(size_t)(k - b.first)];
+			if (m > 0) counts[(size_t)(floorshift(k, s) - first)] += m;
+		}
+		occlo = std::min(occlo, floorshift(b.occlo, s));
+		occhi = std::max(occhi, floorshift(b.occhi, s));
+		n += b.n;
+	}
+
+	//The occupied bins as a cHistogram
+	cHistogram<T, size_t> histogram() const {
+		cHistogram<T, size_t> h;
+		if (n == 0) return h;
+		const double w = std::ldexp(1.0, exponent);
+		h.nbins = (size_t)(occhi - occlo + 1);
+		for (int64_t k = occlo; k <= occhi; k++){
+			h.edge.push_back((T)((double)k * w));
+			h.centre.push_back((T)(((double)k + 0.5) * w));
+			h.count.push_back(counts[(size_t)(k - first)]);
+		}
+		h.edge.push_back((T)((double)(occhi + 1) * w));
+		return h;
+	}
+};
+
 template<typename T>
 class cRange{
 
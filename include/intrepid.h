@@ -15,8 +15,20 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <climits>
 #include <vector>
 #include <list>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
 
 #include "file_utils.h"
+#include "memorymappedfile.h"
 #include "general_utils.h"
 #include "geometry3d.h"
 #include "blocklanguage.h"
@@ -170,6 +182,17 @@ public:
 		return false;
 	}
 
+	template<typename T>
+	static T nullvalue()
+	{
+		static_assert(std::is_arithmetic_v<T>, "IDataType::nullvalue<T>() requires an arithmetic type");
+		if constexpr (std::is_same_v<T, uint8_t>) return ubytenull();
+		else if constexpr (std::is_same_v<T, int16_t>) return shortnull();
+		else if constexpr (std::is_same_v<T, int32_t>) return intnull();
+		else if constexpr (std::is_same_v<T, float>) return floatnull();
+		else return (T)doublenull();
+	}
+
 	double nullasdouble() const {
 		_GSTITEM_
 			switch (itypeid) {
@@ -183,11 +206,40 @@ public:
 	}
 };
 
+//Converts n values of type S that are stride elements apart to T, optionally mapping the Intrepid nulls of S
+//(including non-finite reals) to the Intrepid null of T. The caller switches on the type once per segment,
+//so the loop has no per sample dispatch and is branch free (vectorisable when stride is 1).
+template<typename T, typename S>
+void intrepid_convert(const S* in, const size_t stride, const size_t n, T* out, const bool mapnulls)
+{
+	if (mapnulls == false) {
+		for (size_t i = 0; i < n; i++) out[i] = (T)in[i * stride];
+		return;
+	}
+
+	const T tnull = IDataType::nullvalue<T>();
+	const S snull = IDataType::nullvalue<S>();
+	if constexpr (std::is_floating_point_v<S>) {
+		const S smax = std::numeric_limits<S>::max();
+		for (size_t i = 0; i < n; i++) {
+			const S v = in[i * stride];
+			out[i] = (v == snull || !(std::fabs(v) <= smax)) ? tnull : (T)v;
+		}
+	}
+	else {
+		for (size_t i = 0; i < n; i++) {
+			const S v = in[i * stride];
+			out[i] = (v == snull) ? tnull : (T)v;
+		}
+	}
+}
+
 template<typename T>
 class IData{
 	
 private:
 	std::vector<T> buffer;
+	const T* mapped = nullptr;//Set when the data are read in place from a memory mapped file rather than the buffer
 	
 	size_t ns=0;
 	size_t nb=0;
@@ -202,7 +254,7 @@ private:
 			std::vector<T> v(ns * nb);
 			for (size_t bi = 0; bi < nb; bi++) {
 				for (size_t si = 0; si < ns; si++) {
-					v[bi * ns + si] = buffer[bi];
+					v[bi * ns + si] = data()[bi];
 				}
 			}
 			return v;
@@ -211,7 +263,7 @@ private:
 			std::vector<T> v(nb*ssize);
 			for (size_t bi = 0; bi < nb; bi++) {				
 				for (size_t ei = 0; ei < ssize; ei++) {					
-					v[ssize*bi+ei] = buffer[ssize*bi+ei];
+					v[ssize*bi+ei] = data()[ssize*bi+ei];
 				}				
 			}
 			return v;
@@ -236,19 +288,51 @@ public:
 		ssize = _stringsize;		
 		if (groupby){ nelements = nb*ssize; }
 		else{ nelements = ns*nb*ssize; }
+		mapped = nullptr;
 		buffer.resize(nelements,0);
 	}
+
+	//Use the data at p (eg in a memory mapped file) in place of the buffer, which is only materialised if the data are modified
+	void setmapped(const T* p, const size_t& _ns, const size_t& _nb = 1, const bool& _groupby = false, const size_t _stringsize = 1)
+	{
+		ns = _ns;
+		nb = _nb;
+		groupby = _groupby;
+		ssize = _stringsize;
+		if (groupby){ nelements = nb*ssize; }
+		else{ nelements = ns*nb*ssize; }
+		buffer.clear();
+		mapped = p;
+	}
+
+	bool ismapped() const { return mapped != nullptr; }
+
+	//Copy mapped data into the buffer so that it can be modified
+	void materialise(){
+		if (mapped == nullptr) return;
+		buffer.assign(mapped, mapped + nelements);
+		mapped = nullptr;
+	}
+
+	const T* data() const { return mapped ? mapped : buffer.data(); }
+
+	const T& get(size_t s, size_t b) const {
+		if (groupby){ return data()[b*ssize]; }
+		else{ return data()[(s*nb + b)*ssize]; }
+	}
 	
 	T& operator()(size_t s, size_t b){
+		materialise();
 		if (groupby){ return buffer[b*ssize]; }
 		else{ return buffer[(s*nb + b)*ssize]; }
 	}
 
-	void* pvoid(){ return (void*)buffer.data(); }
+	void* pvoid(){ materialise(); return (void*)buffer.data(); }
 
-	char* pchar(){ return (char*)buffer.data(); }
+	char* pchar(){ materialise(); return (char*)buffer.data(); }
 
 	void  swap_endian(){
+		materialise();
 		::swap_endian(buffer);
 	}
 
@@ -417,6 +501,34 @@ class ILSegment{
 private:
 	ILField&  Field;
 	const size_t lineindex;
+	std::shared_ptr<cMemoryMappedFile> Mapping;//Keeps the field's mapping alive while the IData point into it
+
+	template<typename T>
+	void mapdata(IData<T>& data, const char* p, const size_t stringsize = 1)
+	{
+		data.setmapped((const T*)p, nsamples(), nbands(), isgroupbyline(), stringsize);
+		//Only byte swapped data need their own copy
+		if (endianswap() && sizeof(T) > 1) data.swap_endian();
+	}
+
+	bool mapbuffer();
+
+	//Converts band of the buffer into out, which must have room for n >= nsamples() values (1 if group-by)
+	template<typename T>
+	bool convertband(T* out, const size_t n, const size_t band, const bool mapnulls)
+	{
+		const size_t ns = isgroupbyline() ? 1 : nsamples();
+		const size_t nb = nbands();
+		if (n < ns || band >= nb) return false;
+		switch (getTypeId()){
+			case IDataType::ID::FLOAT: intrepid_convert(fdata.data() + band, nb, ns, out, mapnulls); return true;
+			case IDataType::ID::DOUBLE: intrepid_convert(ddata.data() + band, nb, ns, out, mapnulls); return true;
+			case IDataType::ID::SHORT: intrepid_convert(sdata.data() + band, nb, ns, out, mapnulls); return true;
+			case IDataType::ID::INT: intrepid_convert(idata.data() + band, nb, ns, out, mapnulls); return true;
+			case IDataType::ID::UBYTE: intrepid_convert(ubdata.data() + band, nb, ns, out, mapnulls); return true;
+			default: std::printf("ILSegment::getband() Unknown type"); return false;
+		}
+	}
 
 public:
 			
@@ -438,6 +550,7 @@ public:
 	const size_t& nbands() const;
 	const IDataType& getType();
 	const IDataType::ID& getTypeId();
+	const bool& endianswap() const;
 	FILE* filepointer();
 
 	ILSegment(ILField& _field, size_t _lineindex) : Field(_field), lineindex(_lineindex) {};
@@ -489,21 +602,21 @@ public:
 		
 		switch (getTypeId()){
 			case IDataType::ID::FLOAT:{
-				if (IDataType::isnull(fdata(s, b))) return IDataType::doublenull();
-				else return (double)fdata(s, b);
+				if (IDataType::isnull(fdata.get(s, b))) return IDataType::doublenull();
+				else return (double)fdata.get(s, b);
 			}
-			case IDataType::ID::DOUBLE: return ddata(s, b);
+			case IDataType::ID::DOUBLE: return ddata.get(s, b);
 			case IDataType::ID::SHORT:{
-				if (IDataType::isnull(sdata(s, b))) return IDataType::doublenull();
-				else return (double)sdata(s, b);
+				if (IDataType::isnull(sdata.get(s, b))) return IDataType::doublenull();
+				else return (double)sdata.get(s, b);
 			}
 			case IDataType::ID::INT:{
-				if (IDataType::isnull(idata(s, b))) return IDataType::doublenull();
-				else return (double)idata(s, b);
+				if (IDataType::isnull(idata.get(s, b))) return IDataType::doublenull();
+				else return (double)idata.get(s, b);
 			}
 			case IDataType::ID::UBYTE:{
-				if (IDataType::isnull(ubdata(s, b))) return IDataType::doublenull();
-				else return (double)ubdata(s, b);
+				if (IDataType::isnull(ubdata.get(s, b))) return IDataType::doublenull();
+				else return (double)ubdata.get(s, b);
 			}
 			default:{
 				printf("ILSegment::d() Unknown type"); return IDataType::doublenull();
@@ -514,11 +627,11 @@ public:
 	float f(size_t s, size_t b = 0)
 	{
 		switch (getTypeId()){
-			case IDataType::ID::FLOAT: return fdata(s, b); break;
-			case IDataType::ID::DOUBLE: return (float)ddata(s, b); break;
-			case IDataType::ID::SHORT: return (float)sdata(s, b); break;
-			case IDataType::ID::INT: return (float)idata(s, b); break;
-			case IDataType::ID::UBYTE: return (float)ubdata(s, b); break;
+			case IDataType::ID::FLOAT: return fdata.get(s, b); break;
+			case IDataType::ID::DOUBLE: return (float)ddata.get(s, b); break;
+			case IDataType::ID::SHORT: return (float)sdata.get(s, b); break;
+			case IDataType::ID::INT: return (float)idata.get(s, b); break;
+			case IDataType::ID::UBYTE: return (float)ubdata.get(s, b); break;
 			default: printf("ILSegment::f() Unknown type"); return IDataType::floatnull();
 		}
 	}
@@ -526,11 +639,11 @@ public:
 	int32_t i(size_t s, size_t b = 0)
 	{
 		switch (getTypeId()){
-			case IDataType::ID::FLOAT: return (int32_t)fdata(s, b);
-			case IDataType::ID::DOUBLE: return (int32_t)ddata(s, b);
-			case IDataType::ID::SHORT: return (int32_t)sdata(s, b);
-			case IDataType::ID::INT: return idata(s, b);
-			case IDataType::ID::UBYTE: return (int32_t)ubdata(s, b);
+			case IDataType::ID::FLOAT: return (int32_t)fdata.get(s, b);
+			case IDataType::ID::DOUBLE: return (int32_t)ddata.get(s, b);
+			case IDataType::ID::SHORT: return (int32_t)sdata.get(s, b);
+			case IDataType::ID::INT: return idata.get(s, b);
+			case IDataType::ID::UBYTE: return (int32_t)ubdata.get(s, b);
 			default: printf("ILSegment::i() Unknown type"); return IDataType::intnull();
 		}
 	}
@@ -538,11 +651,11 @@ public:
 	int16_t s(size_t s, size_t b = 0)
 	{
 		switch (getTypeId()){
-			case IDataType::ID::FLOAT: return (int16_t)fdata(s, b);
-			case IDataType::ID::DOUBLE: return (int16_t)ddata(s, b);
-			case IDataType::ID::SHORT: return sdata(s, b);
-			case IDataType::ID::INT: return (int16_t)idata(s, b);
-			case IDataType::ID::UBYTE: return (int16_t)ubdata(s, b);
+			case IDataType::ID::FLOAT: return (int16_t)fdata.get(s, b);
+			case IDataType::ID::DOUBLE: return (int16_t)ddata.get(s, b);
+			case IDataType::ID::SHORT: return sdata.get(s, b);
+			case IDataType::ID::INT: return (int16_t)idata.get(s, b);
+			case IDataType::ID::UBYTE: return (int16_t)ubdata.get(s, b);
 			default: printf("ILSegment::s() Unknown type"); return IDataType::shortnull();
 		}
 	}
@@ -555,7 +668,7 @@ public:
 		v.resize(ns);
 		if(getTypeId() == IDataType::ID::STRING){
 			size_t len = getType().size();
-			char* p = strdata.pchar();
+			const char* p = strdata.data();
 			for (size_t i = 0; i < ns; i++) {
 				v[i] = std::string(p, len);								
 				p += len;
@@ -575,7 +688,7 @@ public:
 
 		if (getTypeId() == IDataType::ID::STRING) {
 			size_t len = getType().size();
-			char* p = strdata.pchar();						
+			const char* p = strdata.data();
 			for (size_t i = 0; i < ns; i++) {				
 				std::string s(p,len);
 				
@@ -594,35 +707,36 @@ public:
 			}
 			return true;
 		}
-				
-		switch (getTypeId()){
-			case IDataType::ID::FLOAT:
-				for (size_t i = 0; i< ns; i++){				
-					v[i] = (T)fdata(i, band);
-				}		
-				return true;
-			case IDataType::ID::DOUBLE:
-				for (size_t i = 0; i< ns; i++){				
-					v[i] = (T)ddata(i, band);
-				}
-				return true;
-			case IDataType::ID::SHORT:
-				for (size_t i = 0; i< ns; i++){				
-					v[i] = (T)sdata(i, band);					
-				}
-				return true;
-			case IDataType::ID::INT:
-				for (size_t i = 0; i< ns; i++){				
-					v[i] = (T)idata(i, band);
-				}
-				return true;
-			case IDataType::ID::UBYTE:
-				for (size_t i = 0; i< ns; i++){				
-					v[i] = (T)ubdata(i, band);
-				}			
-				return true;						
-			default: std::printf("ILSegment::getband() Unknown type"); return false;
+
+		return convertband(v.data(), ns, band, false);
+	}
+
+	//Whole band as float or double with nulls mapped to IDataType::floatnull()/doublenull(), as d() does for each sample.
+	//out must have room for n >= nsamples() values, a group-by field's value is repeated for every sample.
+	template <typename T>
+	bool getband(T* out, const size_t n, const size_t band)
+	{
+		static_assert(std::is_floating_point_v<T>, "ILSegment::getband(T*, n, band) converts to float or double");
+		const size_t ns = nsamples();
+		if (n < ns) return false;
+		if (isgroupbyline() == false) return convertband(out, n, band, true);
+		if (ns == 0) return true;
+		if (convertband(out, 1, band, true) == false) return false;
+		std::fill(out + 1, out + ns, out[0]);
+		return true;
+	}
+
+	//All bands, v[band][sample], with nulls mapped as for getband(T*, n, band)
+	template <typename T>
+	bool getbands(std::vector<std::vector<T>>& v)
+	{
+		const size_t ns = nsamples();
+		v.resize(nbands());
+		for (size_t bi = 0; bi < nbands(); bi++) {
+			v[bi].resize(ns);
+			if (getband(v[bi].data(), ns, bi) == false) return false;
 		}
+		return true;
 	}
 
 	size_t nstored(){
@@ -693,7 +807,31 @@ private:
 	ILDataset& Dataset;
 	IHeader Header;	
 	FILE* pFile = (FILE*)NULL;
+	bool Writable = false;//pFile was opened for writing so it may hold buffered writes
 	std::string Name;
+	bool UseMapping = false;//Read segments in place from a memory mapping of the .PD file
+	std::shared_ptr<cMemoryMappedFile> Mapping;
+	inline static std::mutex OpenMutex;//Serialises the lazy opening and mapping, fields are copied so it cannot be a member
+
+	bool open_unlocked()
+	{
+		if (pFile != (FILE*)NULL)return true;
+		if ((pFile = fileopen(datafilepath(), "rb")) == NULL) {
+			glog.logmsg("ILField::open() cannot open file: %s\n\n", datafilepath().c_str());
+			return false;
+		}
+
+		std::vector<char> buffer(IHeader::nbytes());
+		fread(buffer.data(), IHeader::nbytes(), 1, pFile);
+		Header = IHeader(buffer.data(),datafilepath());
+		if (Header.valid==false){
+			glog.logmsg("Could not read header in file: %s\n\n", datafilepath().c_str());
+			fclose(pFile);
+			pFile = (FILE*)NULL;
+			return false;
+		}		
+		return true;
+	}
 
 public:	
 		
@@ -708,8 +846,33 @@ public:
 	const size_t& nbands() const { return Header.nbands; };	
 	const size_t& nlines() const;
 	FILE* filepointer() { return pFile; }	
+	bool iswritable() const { return Writable; }
 	
 	const bool& endianswap() const { return Header.endianswap; }
+
+	//In mapped mode ILSegment::readbuffer() points the segment's data straight into the page cache instead of
+	//copying it through stdio, only byte swapped or modified data get their own buffer
+	void usemapping(const bool on = true)
+	{
+		UseMapping = on;
+		if (on == false) Mapping.reset();
+	}
+
+	bool usesmapping() const { return UseMapping; }
+
+	std::shared_ptr<cMemoryMappedFile> mapping()
+	{
+		std::lock_guard<std::mutex> lock(OpenMutex);
+		if (Mapping) return Mapping;
+		if (open_unlocked() == false) return Mapping;
+		auto m = std::make_shared<cMemoryMappedFile>();
+		if (m->open(datafilepath()) == false) {
+			glog.logmsg("ILField::mapping() cannot memory map file: %s\n\n", datafilepath().c_str());
+			return Mapping;
+		}
+		Mapping = m;
+		return Mapping;
+	}
 	
 	bool isgroupbyline() const
 	{
@@ -751,25 +914,47 @@ public:
 	
 	bool create_new(const std::string& fieldname, const IDataType& datatype, const size_t& nbands, const bool& indexed);
 
+	//Safe to call from several threads, but close() is not and must not be called while other threads are reading
 	bool open()
 	{
-		if (pFile != (FILE*)NULL)return true;
-		if ((pFile = fileopen(datafilepath(), "rb")) == NULL) {
-			glog.logmsg("ILField::open() cannot open file: %s\n\n", datafilepath().c_str());
-			return false;
-		}
+		std::lock_guard<std::mutex> lock(OpenMutex);
+		return open_unlocked();
+	}
 
-		std::vector<char> buffer(IHeader::nbytes());
-		fread(buffer.data(), IHeader::nbytes(), 1, pFile);
-		Header = IHeader(buffer.data(),datafilepath());
-		if (Header.valid==false){
-			glog.logmsg("Could not read header in file: %s\n\n", datafilepath().c_str());
-			fclose(pFile);
-			pFile = (FILE*)NULL;
-			return false;
-		}		
+	//Positional read of nbytes at byte offset of the (open) file, which bypasses the FILE's buffer so that several threads can
+	//read the field concurrently. Buffered writes of a writable handle are flushed first. On POSIX the file position is not
+	//moved, but on Windows ReadFile also moves the handle's file pointer, so stdio access to the FILE must seek absolutely.
+	bool readat(void* buf, const size_t nbytes, const size_t offset)
+	{
+		if (Writable) {
+			std::lock_guard<std::mutex> lock(OpenMutex);
+			if (fflush(pFile) != 0) return false;
+		}
+		char* p = (char*)buf;
+		size_t done = 0;
+#if defined _WIN32
+		HANDLE h = (HANDLE)_get_osfhandle(_fileno(pFile));
+		while (done < nbytes) {
+			const uint64_t off = (uint64_t)(offset + done);
+			OVERLAPPED ov = {};
+			ov.Offset = (DWORD)(off & 0xFFFFFFFF);
+			ov.OffsetHigh = (DWORD)(off >> 32);
+			DWORD n = 0;
+			const DWORD want = (DWORD)std::min(nbytes - done, (size_t)0x40000000);
+			if (ReadFile(h, p + done, want, &n, &ov) == FALSE || n == 0) return false;
+			done += n;
+		}
+#else
+		const int fd = fileno(pFile);
+		while (done < nbytes) {
+			const ssize_t n = pread(fd, p + done, nbytes - done, (off_t)(offset + done));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			done += (size_t)n;
+		}
+#endif
 		return true;
-	}	
+	}
 	
 	void close()
 	{
@@ -777,6 +962,8 @@ public:
 			fclose(pFile);
 		}
 		pFile = (FILE*)NULL;
+		Writable = false;
+		Mapping.reset();//Segments still using it keep it alive
 	}
 	
 	bool erase()
@@ -864,6 +1051,359 @@ public:
 	
 };
 
+//Thread safe LRU cache of read segments keyed by (field, line) with a byte budget that the pinned segments count against.
+//Segments of pinned fields are never evicted. The cached segments are shared and must not be modified,
+//ILSegment::writebuffer() drops the cached segment of the line it writes.
+class ILSegmentCache {
+
+private:
+	using Key = std::pair<const ILField*, size_t>;
+
+	struct KeyHash {
+		size_t operator()(const Key& k) const {
+			return std::hash<const void*>()((const void*)k.first) ^ (k.second * 0x9E3779B97F4A7C15ULL);
+		}
+	};
+
+	struct Entry {
+		std::shared_ptr<ILSegment> segment;
+		size_t bytes = 0;
+		bool pinned = false;
+		std::list<Key>::iterator lru;//Position in LRU, only if not pinned
+	};
+
+	mutable std::mutex Mutex;
+	size_t Budget;
+	size_t Bytes = 0;//Of the unpinned segments
+	size_t PinnedBytes = 0;
+	size_t Hits = 0;
+	size_t Misses = 0;
+	std::list<Key> LRU;//Unpinned segments, most recently used first
+	std::unordered_map<Key, Entry, KeyHash> Entries;
+	std::set<const ILField*> Pinned;
+
+	void evict_unlocked()
+	{
+		while (Bytes + PinnedBytes > Budget && LRU.size() > 0) {
+			auto it = Entries.find(LRU.back());
+			Bytes -= it->second.bytes;
+			Entries.erase(it);
+			LRU.pop_back();
+		}
+	}
+
+public:
+
+	ILSegmentCache(const size_t budget = 256 * 1024 * 1024) : Budget(budget) {};
+
+	//The segment of line li of field F, read on a miss. nullptr if it could not be read.
+	std::shared_ptr<ILSegment> get(ILField& F, const size_t li)
+	{
+		const Key key(&F, li);
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			auto it = Entries.find(key);
+			if (it != Entries.end()) {
+				Hits++;
+				if (it->second.pinned == false) LRU.splice(LRU.begin(), LRU, it->second.lru);
+				return it->second.segment;
+			}
+			Misses++;
+		}
+
+		//Read without the lock so that other threads' hits are not held up
+		auto segment = std::make_shared<ILSegment>(F, li);
+		if (segment->readbuffer() == false) return nullptr;
+		const size_t nbytes = segment->nbytes();
+
+		std::lock_guard<std::mutex> lock(Mutex);
+		auto it = Entries.find(key);
+		if (it != Entries.end()) return it->second.segment;//Another thread read it meanwhile
+
+		Entry e;
+		e.segment = segment;
+		e.bytes = nbytes;
+		e.pinned = Pinned.count(&F) > 0;
+		if (e.pinned) {
+			PinnedBytes += nbytes;
+		}
+		else {
+			if (nbytes + PinnedBytes > Budget) return segment;//Too big to keep
+			LRU.push_front(key);
+			e.lru = LRU.begin();
+			Bytes += nbytes;
+		}
+		Entries.emplace(key, std::move(e));
+		evict_unlocked();
+		return segment;
+	}
+
+	void setbudget(const size_t budget)
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Budget = budget;
+		evict_unlocked();
+	}
+
+	//Keep the segments of F (already cached and future) until unpinned
+	void pin(const ILField& F)
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Pinned.insert(&F);
+		for (auto it = LRU.begin(); it != LRU.end();) {
+			Entry& e = Entries[*it];
+			if (it->first == &F) {
+				e.pinned = true;
+				Bytes -= e.bytes;
+				PinnedBytes += e.bytes;
+				it = LRU.erase(it);
+			}
+			else ++it;
+		}
+	}
+
+	void unpin(const ILField& F)
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Pinned.erase(&F);
+		for (auto& [key, e] : Entries) {
+			if (key.first == &F && e.pinned) {
+				e.pinned = false;
+				PinnedBytes -= e.bytes;
+				Bytes += e.bytes;
+				LRU.push_back(key);
+				e.lru = std::prev(LRU.end());
+			}
+		}
+		evict_unlocked();
+	}
+
+	bool ispinned(const ILField& F) const
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		return Pinned.count(&F) > 0;
+	}
+
+	//Drop the segments of F, eg when it is erased
+	void erase(const ILField& F)
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Pinned.erase(&F);
+		for (auto it = Entries.begin(); it != Entries.end();) {
+			if (it->first.first == &F) {
+				if (it->second.pinned) PinnedBytes -= it->second.bytes;
+				else {
+					Bytes -= it->second.bytes;
+					LRU.erase(it->second.lru);
+				}
+				it = Entries.erase(it);
+			}
+			else ++it;
+		}
+	}
+
+	//Drop the segment of line li of F, eg when it has been written
+	void erase(const ILField& F, const size_t li)
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		auto it = Entries.find(Key(&F, li));
+		if (it == Entries.end()) return;
+		if (it->second.pinned) PinnedBytes -= it->second.bytes;
+		else {
+			Bytes -= it->second.bytes;
+			LRU.erase(it->second.lru);
+		}
+		Entries.erase(it);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Entries.clear();
+		LRU.clear();
+		Bytes = 0;
+		PinnedBytes = 0;
+	}
+
+	void resetcounters()
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Hits = 0;
+		Misses = 0;
+	}
+
+	size_t budget() const { std::lock_guard<std::mutex> lock(Mutex); return Budget; }
+	size_t bytes() const { std::lock_guard<std::mutex> lock(Mutex); return Bytes + PinnedBytes; }
+	size_t pinnedbytes() const { std::lock_guard<std::mutex> lock(Mutex); return PinnedBytes; }
+	size_t size() const { std::lock_guard<std::mutex> lock(Mutex); return Entries.size(); }
+	size_t hits() const { std::lock_guard<std::mutex> lock(Mutex); return Hits; }
+	size_t misses() const { std::lock_guard<std::mutex> lock(Mutex); return Misses; }
+};
+
+//Uniform grid over the survey X/Y with the coordinates and (line, sample) indices of every non-null sample bucketed by cell.
+//The buckets are stored contiguously (cell c has entries [cellstart[c], cellstart[c+1])) in line then sample order.
+class ILSpatialIndex {
+
+public:
+	double xmin = 0.0;
+	double ymin = 0.0;
+	double cellsize = 1.0;
+	size_t nx = 0;
+	size_t ny = 0;
+	std::vector<uint64_t> cellstart;
+	std::vector<uint32_t> lines;
+	std::vector<uint32_t> samples;
+	std::vector<double> xs;
+	std::vector<double> ys;
+
+	bool empty() const { return lines.size() == 0; }
+
+	size_t ncells() const { return nx * ny; }
+
+	//Cell column of x clamped to the grid, written so that NaN (-> 0) and huge values never reach the size_t conversion
+	size_t cellx(const double& x) const {
+		const double c = std::floor((x - xmin) / cellsize);
+		if (!(c > 0.0)) return 0;
+		if (c >= (double)(nx - 1)) return nx - 1;
+		return (size_t)c;
+	}
+
+	size_t celly(const double& y) const {
+		const double c = std::floor((y - ymin) / cellsize);
+		if (!(c > 0.0)) return 0;
+		if (c >= (double)(ny - 1)) return ny - 1;
+		return (size_t)c;
+	}
+
+	//Builds the grid for points (x[k], y[k]) which are sample si[k] of line li[k], aiming for about persell points per cell
+	void build(const std::vector<double>& x, const std::vector<double>& y, const std::vector<uint32_t>& li, const std::vector<uint32_t>& si, const double persell = 8.0)
+	{
+		const size_t n = x.size();
+		lines.clear();
+		samples.clear();
+		xs.clear();
+		ys.clear();
+		cellstart.assign(1, 0);
+		nx = ny = 0;
+		if (n == 0) return;
+
+		xmin = *std::min_element(x.begin(), x.end());
+		ymin = *std::min_element(y.begin(), y.end());
+		const double w = *std::max_element(x.begin(), x.end()) - xmin;
+		const double h = *std::max_element(y.begin(), y.end()) - ymin;
+		const double ncellstarget = std::max(1.0, (double)n / persell);
+		//The floor keeps ncells() to about 2*ncellstarget for nearly collinear surveys, where sqrt(w*h/n) would be tiny
+		cellsize = std::max(std::sqrt(w * h / ncellstarget), std::max(w, h) / ncellstarget);
+		if (cellsize <= 0.0) cellsize = 1.0;
+		nx = (size_t)std::floor(w / cellsize) + 1;
+		ny = (size_t)std::floor(h / cellsize) + 1;
+
+		//Counting sort by cell, which keeps the line then sample order within each cell
+		std::vector<size_t> cellof(n);
+		cellstart.assign(ncells() + 1, 0);
+		for (size_t k = 0; k < n; k++) {
+			cellof[k] = celly(y[k]) * nx + cellx(x[k]);
+			cellstart[cellof[k] + 1]++;
+		}
+		for (size_t c = 0; c < ncells(); c++) cellstart[c + 1] += cellstart[c];
+		std::vector<uint64_t> next(cellstart.begin(), cellstart.end() - 1);
+		lines.resize(n);
+		samples.resize(n);
+		xs.resize(n);
+		ys.resize(n);
+		for (size_t k = 0; k < n; k++) {
+			const uint64_t e = next[cellof[k]]++;
+			lines[e] = li[k];
+			samples[e] = si[k];
+			xs[e] = x[k];
+			ys[e] = y[k];
+		}
+	}
+
+	//Calls func(lineindex, sampleindex, x, y) for the entries of cells [ix0, ix1] x [iy0, iy1]
+	template<typename Func>
+	void for_each_in_cells(const size_t ix0, const size_t ix1, const size_t iy0, const size_t iy1, Func func) const
+	{
+		for (size_t iy = iy0; iy <= iy1; iy++) {
+			const size_t c = iy * nx;
+			for (uint64_t e = cellstart[c + ix0]; e < cellstart[c + ix1 + 1]; e++) {
+				func((size_t)lines[e], (size_t)samples[e], xs[e], ys[e]);
+			}
+		}
+	}
+
+	//Key identifying what the index was built from is written at the start of the file and checked by load()
+	bool save(const std::string& path, const std::string& key) const
+	{
+		return write_sidecar_atomically(path, [&](std::ofstream& ofs) {
+			ofs << "ILDATASET_SPATIALINDEX 1\n";
+			ofs << key;
+			ofs << strprint("grid %.17g %.17g %.17g %zu %zu %zu\n", xmin, ymin, cellsize, nx, ny, lines.size());
+			ofs.write((const char*)cellstart.data(), (std::streamsize)(cellstart.size() * sizeof(uint64_t)));
+			ofs.write((const char*)lines.data(), (std::streamsize)(lines.size() * sizeof(uint32_t)));
+			ofs.write((const char*)samples.data(), (std::streamsize)(samples.size() * sizeof(uint32_t)));
+			ofs.write((const char*)xs.data(), (std::streamsize)(xs.size() * sizeof(double)));
+			ofs.write((const char*)ys.data(), (std::streamsize)(ys.size() * sizeof(double)));
+		}, std::ios::binary);
+	}
+
+	bool load(const std::string& path, const std::string& key)
+	{
+		std::ifstream ifs(path, std::ios::binary);
+		if (!ifs) return false;
+		std::string line, filekey;
+		bool valid = (std::getline(ifs, line) && line == "ILDATASET_SPATIALINDEX 1");
+		const size_t nkeylines = (size_t)std::count(key.begin(), key.end(), '\n');
+		for (size_t k = 0; valid && k < nkeylines; k++) {
+			valid = (bool)std::getline(ifs, line);
+			filekey += line + "\n";
+		}
+		if (valid == false || filekey != key || !std::getline(ifs, line)) return false;
+
+		double x0, y0, cs;
+		size_t mx, my, n;
+		if (std::sscanf(line.c_str(), "grid %lf %lf %lf %zu %zu %zu", &x0, &y0, &cs, &mx, &my, &n) != 6) return false;
+
+		//The grid size and sample count must fit in what is left of the file before anything is allocated
+		const std::streamoff here = ifs.tellg();
+		ifs.seekg(0, std::ios::end);
+		const std::streamoff fileend = ifs.tellg();
+		ifs.seekg(here, std::ios::beg);
+		if (!ifs || here < 0 || fileend < here) return false;
+		const size_t remaining = (size_t)(fileend - here);
+		if (n > 0 && (!(cs > 0.0) || std::isfinite(cs) == false || mx == 0 || my == 0)) return false;
+		if (my > 0 && mx > (std::numeric_limits<size_t>::max() - 1) / my) return false;
+		const size_t ncells = mx * my + 1;
+		const size_t samplebytes = 2 * sizeof(uint32_t) + 2 * sizeof(double);
+		if (ncells > remaining / sizeof(uint64_t) || n > (remaining - ncells * sizeof(uint64_t)) / samplebytes) return false;
+
+		std::vector<uint64_t> cs0(ncells);
+		std::vector<uint32_t> l0(n), s0(n);
+		std::vector<double> x0s(n), y0s(n);
+		ifs.read((char*)cs0.data(), (std::streamsize)(cs0.size() * sizeof(uint64_t)));
+		ifs.read((char*)l0.data(), (std::streamsize)(l0.size() * sizeof(uint32_t)));
+		ifs.read((char*)s0.data(), (std::streamsize)(s0.size() * sizeof(uint32_t)));
+		ifs.read((char*)x0s.data(), (std::streamsize)(x0s.size() * sizeof(double)));
+		ifs.read((char*)y0s.data(), (std::streamsize)(y0s.size() * sizeof(double)));
+		if (!ifs || cs0.front() != 0 || cs0.back() != n) return false;
+		for (size_t c = 1; c < cs0.size(); c++) {
+			if (cs0[c] < cs0[c - 1]) return false;
+		}
+
+		xmin = x0;
+		ymin = y0;
+		cellsize = cs;
+		nx = mx;
+		ny = my;
+		cellstart = std::move(cs0);
+		lines = std::move(l0);
+		samples = std::move(s0);
+		xs = std::move(x0s);
+		ys = std::move(y0s);
+		return true;
+	}
+};
+
 class ILDataset{
 
 private:	
@@ -931,6 +1471,8 @@ private:
 	}
 	
 	ILField NullField;
+	ILSegmentCache SegmentCache;
+	ILSpatialIndex SpatialIndex;
 
 public:
 	
@@ -1188,6 +1730,31 @@ public:
 		return false;
 	}
 
+	void usemapping(const bool on = true)
+	{
+		for (auto it = Fields.begin(); it != Fields.end(); ++it) {
+			it->usemapping(on);
+		}
+	}
+
+	//Shared read-only segment of line li of field F through the dataset's LRU cache, nullptr if it could not be read
+	std::shared_ptr<ILSegment> getsegment(ILField& F, const size_t li)
+	{
+		return SegmentCache.get(F, li);
+	}
+
+	ILSegmentCache& segmentcache() { return SegmentCache; }
+
+	//Keep the coordinates and line numbers that the spatial queries use in the segment cache, they count against its budget
+	void pinsurveyinfofields()
+	{
+		for (const std::string key : { "X", "Y", "LineNumber" }) {
+			if (hassurveyinfokey_and_fieldexists(key)) {
+				SegmentCache.pin(getsurveyinfofield(key));
+			}
+		}
+	}
+
 	ILField& getfield(const std::string& fieldname)
 	{
 		_GSTITEM_
@@ -1204,7 +1771,7 @@ public:
 		_GSTITEM_
 		std::string fieldname;
 		bool status = surveyinfofieldname(key,fieldname);
-		if (status){
+		if (status == false){
 			printf("Cannot find field %s from SurveyInfo:\n\n", key.c_str());
 			return getNullField();
 		}
@@ -1216,6 +1783,7 @@ public:
 		_GSTITEM_
 		for (auto it = Fields.begin(); it != Fields.end(); ++it){
 			if (strcasecmp(it->getName().c_str(), fieldname.c_str()) == 0){
+				SegmentCache.erase(*it);
 				bool status = it->erase();
 				if (status){
 					Fields.erase(it);
@@ -1305,6 +1873,140 @@ public:
 		return false;
 	}
 
+	//Sidecar file, beside the dataset directory, in which load_or_build_spatialindex() caches the spatial index
+	std::string spatialindexpath() const
+	{
+		std::string p = datasetpath;
+		removetrailingseparator(p);
+		return p + ".spatialindex";
+	}
+
+	//Key identifying the INDEX, X and Y files (name, size and modification time) the spatial index is built from
+	std::string spatialindexkey()
+	{
+		std::string key;
+		for (const std::string& path : { indexpath, getsurveyinfofield("X").datafilepath(), getsurveyinfofield("Y").datafilepath() }) {
+			std::error_code ec;
+			const size_t size = (size_t)std::filesystem::file_size(path, ec);
+			const int64_t mtime = (int64_t)std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+			key += strprint("file %s size %zu mtime %lld\n", extractfilename(path).c_str(), size, (long long)mtime);
+		}
+		return key;
+	}
+
+	//Builds the spatial index over the X and Y of every non-null sample
+	bool buildspatialindex()
+	{
+		_GSTITEM_
+		if (hassurveyinfokey_and_fieldexists("X") == false || hassurveyinfokey_and_fieldexists("Y") == false) {
+			glog.logmsg("ILDataset::buildspatialindex() the SurveyInfo X and Y fields are needed\n\n");
+			return false;
+		}
+		ILField& fX = getsurveyinfofield("X");
+		ILField& fY = getsurveyinfofield("Y");
+
+		std::vector<double> x, y, bx, by;
+		std::vector<uint32_t> li, si;
+		x.reserve(nsamples());
+		y.reserve(nsamples());
+		li.reserve(nsamples());
+		si.reserve(nsamples());
+		for (size_t l = 0; l < nlines(); l++) {
+			std::shared_ptr<ILSegment> sX = getsegment(fX, l);
+			std::shared_ptr<ILSegment> sY = getsegment(fY, l);
+			if (!sX || !sY) return false;
+			const size_t ns = sX->nsamples();
+			bx.resize(ns);
+			by.resize(ns);
+			sX->getband(bx.data(), ns, 0);
+			sY->getband(by.data(), ns, 0);
+			for (size_t s = 0; s < ns; s++) {
+				if (IDataType::isnull(bx[s]) || IDataType::isnull(by[s])) continue;
+				x.push_back(bx[s]);
+				y.push_back(by[s]);
+				li.push_back((uint32_t)l);
+				si.push_back((uint32_t)s);
+			}
+		}
+		SpatialIndex.build(x, y, li, si);
+		return true;
+	}
+
+	//Loads the spatial index from the sidecar file if it is up to date, otherwise builds it and rewrites the file.
+	//Once there is an index nearestsample() and sampleswithindistance() use it. Returns true if an index is available,
+	//usedfile is set to whether it came from the sidecar file.
+	bool load_or_build_spatialindex(bool& usedfile)
+	{
+		_GSTITEM_
+		usedfile = false;
+		if (hassurveyinfokey_and_fieldexists("X") == false || hassurveyinfokey_and_fieldexists("Y") == false) {
+			glog.logmsg("ILDataset::load_or_build_spatialindex() the SurveyInfo X and Y fields are needed\n\n");
+			return false;
+		}
+		const std::string path = spatialindexpath();
+		const std::string key = spatialindexkey();
+		if (SpatialIndex.load(path, key)) {
+			usedfile = true;
+			return true;
+		}
+		if (buildspatialindex() == false) return false;
+		if (SpatialIndex.save(path, key) == false) {
+			glog.logmsg("ILDataset: unable to write spatial index file %s\n\n", path.c_str());
+		}
+		return true;
+	}
+
+	bool load_or_build_spatialindex()
+	{
+		bool usedfile;
+		return load_or_build_spatialindex(usedfile);
+	}
+
+	bool hasspatialindex() const { return SpatialIndex.ncells() > 0; }
+
+	//Calls func(lineindex) for every line on nthreads threads (0 = all hardware threads), lines are handed out one at a time.
+	//func may also take the zero based worker number (< nthreads) as a second argument, eg to update per thread accumulators.
+	//func should construct its own ILSegments, their readbuffer() uses positional reads (or the mapping) so any
+	//field and line can be read concurrently, but fields must not be closed (or added or erased) until it returns.
+	template<typename Func>
+	void parallel_for_each_line(Func func, size_t nthreads = 0)
+	{
+		_GSTITEM_
+		if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+		if (nthreads > nlines()) nthreads = nlines();
+
+		std::atomic<size_t> nextline(0);
+		std::exception_ptr error = nullptr;
+		std::mutex errormutex;
+
+		auto worker = [&](const size_t workerindex) {
+			try {
+				size_t li;
+				while ((li = nextline++) < nlines()) {
+					if constexpr (std::is_invocable_v<Func, size_t, size_t>) {
+						func(li, workerindex);
+					}
+					else {
+						func(li);
+					}
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(errormutex);
+				if (error == nullptr) error = std::current_exception();
+				nextline = nlines();//stop the other threads early
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < nthreads; i++) {
+			threads.emplace_back(worker, i);
+		}
+		if (nthreads > 0) worker(0);
+		for (auto& t : threads) t.join();
+		if (error) std::rethrow_exception(error);
+	}
+
 	void bestfitlines()
 	{
 		_GSTITEM_
@@ -1314,8 +2016,15 @@ public:
 		ILField& fY = getsurveyinfofield("Y");
 
 		for (size_t li = 0; li<nlines(); li++){
-			ILSegment sX(fX,li);
-			ILSegment sY(fY,li);
+			std::shared_ptr<ILSegment> pX = getsegment(fX, li);
+			std::shared_ptr<ILSegment> pY = getsegment(fY, li);
+			if (!pX || !pY) {
+				glog.logmsg("ILDataset::bestfitlines() could not read the X and Y of line index %zu\n", li);
+				bestfitlinesegs.clear();
+				return;
+			}
+			ILSegment& sX = *pX;
+			ILSegment& sY = *pY;
 			size_t numsamples = sX.nsamples();
 
 			////Find first and last non nulls
@@ -1383,8 +2092,6 @@ public:
 			seg.set(p1, p2);
 			bestfitlinesegs.insert(bestfitlinesegs.end(), seg);
 		}
-		fX.close();
-		fY.close();
 	}
 	
 	
@@ -1451,9 +2158,63 @@ public:
 		return index;
 	}
 
+	//Exact nearest non-null sample by searching rings of spatial index cells outwards until no unsearched cell can be closer
+	double nearestsample_indexed(const cPnt p, size_t& lineindex, size_t& sampleindex, double& x, double& y)
+	{
+		_GSTITEM_
+		const ILSpatialIndex& I = SpatialIndex;
+		double mind2 = DBL_MAX;
+		lineindex = nullindex();
+		sampleindex = nullindex();
+		if (std::isfinite(p.x) == false || std::isfinite(p.y) == false) return IDataType::doublenull();
+		auto visit = [&](const size_t li, const size_t si, const double sx, const double sy) {
+			const double dx = p.x - sx;
+			const double dy = p.y - sy;
+			const double d2 = dx * dx + dy * dy;
+			if (d2 < mind2) {
+				mind2 = d2;
+				lineindex = li;
+				sampleindex = si;
+				x = sx;
+				y = sy;
+			}
+		};
+
+		const long cx = (long)I.cellx(p.x);
+		const long cy = (long)I.celly(p.y);
+		const long nx = (long)I.nx;
+		const long ny = (long)I.ny;
+		for (long r = 0; ; r++) {
+			const long x0 = cx - r, x1 = cx + r, y0 = cy - r, y1 = cy + r;
+			//The cells on the boundary of the (2r+1) square, clipped to the grid
+			for (long iy = std::max(y0, 0L); iy <= std::min(y1, ny - 1); iy++) {
+				if (iy == y0 || iy == y1) {
+					I.for_each_in_cells((size_t)std::max(x0, 0L), (size_t)std::min(x1, nx - 1), (size_t)iy, (size_t)iy, visit);
+				}
+				else {
+					if (x0 >= 0) I.for_each_in_cells((size_t)x0, (size_t)x0, (size_t)iy, (size_t)iy, visit);
+					if (x1 < nx) I.for_each_in_cells((size_t)x1, (size_t)x1, (size_t)iy, (size_t)iy, visit);
+				}
+			}
+
+			//Distance from p to the nearest cell outside the searched square
+			double bound = DBL_MAX;
+			if (x1 < nx - 1) bound = std::min(bound, I.xmin + (double)(x1 + 1) * I.cellsize - p.x);
+			if (x0 > 0) bound = std::min(bound, p.x - (I.xmin + (double)x0 * I.cellsize));
+			if (y1 < ny - 1) bound = std::min(bound, I.ymin + (double)(y1 + 1) * I.cellsize - p.y);
+			if (y0 > 0) bound = std::min(bound, p.y - (I.ymin + (double)y0 * I.cellsize));
+			if (bound == DBL_MAX) break;//Whole grid searched
+			if (mind2 < DBL_MAX && bound > 0.0 && mind2 <= bound * bound) break;
+		}
+		return std::sqrt(mind2);
+	}
+
 	double nearestsample(const cPnt p, size_t& lineindex, size_t& sampleindex, double& x, double& y)
 	{
 		_GSTITEM_
+		if (hasspatialindex() && SpatialIndex.empty() == false) {
+			return nearestsample_indexed(p, lineindex, sampleindex, x, y);
+		}
 		lineindex = nearestbestfitline(p);
 		sampleindex = 0;
 
@@ -1462,8 +2223,11 @@ public:
 		ILField& fX = getsurveyinfofield("X");
 		ILField& fY = getsurveyinfofield("Y");
 
-		ILSegment sX(fX,lineindex);
-		ILSegment sY(fY,lineindex);
+		std::shared_ptr<ILSegment> pX = getsegment(fX, lineindex);
+		std::shared_ptr<ILSegment> pY = getsegment(fY, lineindex);
+		if (!pX || !pY) return IDataType::doublenull();
+		ILSegment& sX = *pX;
+		ILSegment& sY = *pY;
 
 		for (size_t si = 0; si<sX.nsamples(); si++){
 			double dx = p.x - sX.d(si);
@@ -1483,6 +2247,9 @@ public:
 	std::vector<SampleIndex> sampleswithindistance(cPnt p, double distance)
 	{
 		_GSTITEM_
+		if (hasspatialindex()) {
+			return sampleswithindistance_indexed(p, distance);
+		}
 		bestfitlines();
 		std::vector<SampleIndex> samples;
 
@@ -1492,8 +2259,11 @@ public:
 		for (size_t li = 0; li<nlines(); li++){
 			double d = distancetobestfitline(p, li);
 			if (d<distance*2.0){
-				ILSegment sX(fX,li);
-				ILSegment sY(fY,li);
+				std::shared_ptr<ILSegment> pX = getsegment(fX, li);
+				std::shared_ptr<ILSegment> pY = getsegment(fY, li);
+				if (!pX || !pY) continue;
+				ILSegment& sX = *pX;
+				ILSegment& sY = *pY;
 				size_t nsam = sX.nsamples();
 				for (size_t si = 0; si<nsam; si++){
 					cPnt p1(sX.d(si), sY.d(si), 0.0);
@@ -1506,8 +2276,32 @@ public:
 				}
 			}
 		}
-		fX.close();
-		fY.close();
+		return samples;
+	}
+
+	//Non-null samples within distance of p from the spatial index cells overlapping the circle, in line then sample order
+	std::vector<SampleIndex> sampleswithindistance_indexed(const cPnt p, const double distance)
+	{
+		_GSTITEM_
+		const ILSpatialIndex& I = SpatialIndex;
+		std::vector<SampleIndex> samples;
+		if (I.empty()) return samples;
+		if (std::isfinite(p.x) == false || std::isfinite(p.y) == false || std::isnan(distance)) return samples;
+
+		I.for_each_in_cells(I.cellx(p.x - distance), I.cellx(p.x + distance), I.celly(p.y - distance), I.celly(p.y + distance),
+			[&](const size_t li, const size_t si, const double sx, const double sy) {
+				cPnt p1(sx, sy, 0.0);
+				if (p.distance(p1) <= distance) {
+					struct SampleIndex sam;
+					sam.lineindex = li;
+					sam.sampleindex = si;
+					samples.push_back(sam);
+				}
+			});
+
+		std::sort(samples.begin(), samples.end(), [](const SampleIndex& a, const SampleIndex& b) {
+			return a.lineindex < b.lineindex || (a.lineindex == b.lineindex && a.sampleindex < b.sampleindex);
+		});
 		return samples;
 	}
 
@@ -1537,14 +2331,15 @@ public:
 		ILField& F = getfield(fieldname);
 		std::vector<double> v;
 		v.reserve(nsamples());		
+		std::vector<double> band;
 		for (size_t li = 0; li < nlines(); li++){
 			ILSegment S(F,li);			
 			S.readbuffer();	
-			size_t nsamples = S.nsamples();			
-			for (size_t si = 0; si < nsamples; si++){				
-				double val = S.d(si);
-				if (IDataType::isnull(val)==false){
-					v.push_back(val);					
+			band.resize(S.nsamples());
+			S.getband(band.data(), band.size(), 0);
+			for (size_t si = 0; si < band.size(); si++){
+				if (IDataType::isnull(band[si])==false){
+					v.push_back(band[si]);
 				}				
 			}
 		}				
@@ -1629,6 +2424,8 @@ const IDataType& ILSegment::getType() { return Field.getType(); }
 
 const IDataType::ID& ILSegment::getTypeId() { return Field.getTypeId(); }
 
+const bool& ILSegment::endianswap() const { return Field.endianswap(); }
+
 FILE* ILSegment::filepointer() { return Field.filepointer(); }
 
 bool ILSegment::isgroupbyline()
@@ -1643,65 +2440,91 @@ bool ILSegment::isindexed()
 
 bool ILSegment::readbuffer()
 {
-	size_t n;
+	//A mapping would not see the buffered or later writes of a writable handle
+	if (Field.usesmapping() && Field.iswritable() == false) return mapbuffer();
+
 	bool status = Field.open();
 	if (status == false){
 		return false;
 	}
 
-	long move = fileposition() - std::ftell(filepointer());
-	std::fseek(filepointer(), move, SEEK_CUR);
+	//Positional reads so that segments of the same field can be read by several threads at once
+	const size_t offset = (size_t)fileposition();
 	const size_t len = getType().size();
 
 	switch (getTypeId()){
 	case IDataType::ID::FLOAT:
 		fdata.resize(nsamples(), nbands(), isgroupbyline());
-		n = std::fread(fdata.pvoid(), nbytes(), 1, filepointer());
+		status = Field.readat(fdata.pvoid(), nbytes(), offset);
 		if(Field.endianswap()) fdata.swap_endian();
 		break;
 	case IDataType::ID::DOUBLE:
 		ddata.resize(nsamples(), nbands(), isgroupbyline());
-		n = std::fread(ddata.pvoid(), nbytes(), 1, filepointer());
+		status = Field.readat(ddata.pvoid(), nbytes(), offset);
 		if (Field.endianswap()) ddata.swap_endian();
 		break;
 	case IDataType::ID::SHORT:
 		sdata.resize(nsamples(), nbands(), isgroupbyline());
-		n = std::fread(sdata.pvoid(), nbytes(), 1, filepointer());
+		status = Field.readat(sdata.pvoid(), nbytes(), offset);
 		if (Field.endianswap()) sdata.swap_endian();
 		break;
 	case IDataType::ID::INT:
 		idata.resize(nsamples(), nbands(), isgroupbyline());
-		n = std::fread(idata.pvoid(), nbytes(), 1, filepointer());
+		status = Field.readat(idata.pvoid(), nbytes(), offset);
 		if (Field.endianswap()){
 			idata.swap_endian();
 		}
 		break;
 	case IDataType::ID::UBYTE:
 		ubdata.resize(nsamples(), nbands(), isgroupbyline() );
-		n = std::fread(ubdata.pvoid(), nbytes(), 1, filepointer());
+		status = Field.readat(ubdata.pvoid(), nbytes(), offset);
 		if (Field.endianswap()) ubdata.swap_endian();
 		break;
 	case IDataType::ID::STRING:
 		strdata.resize(nsamples(), nbands(), isgroupbyline(), len);
-		n = std::fread(strdata.pvoid(), nbytes(), 1, filepointer());
+		status = Field.readat(strdata.pvoid(), nbytes(), offset);
 		if (Field.endianswap()) strdata.swap_endian();
 		break;
 	default: std::printf("ILSegment::read() Unknown type"); return false;
 	}
 		
-	if (n != 1){
+	if (status == false){
 		std::printf("ILSegment::readbuffer Error reading file %s\n", Field.datafilepath().c_str());
 		return false;
 	}	
 	return true;
 }
 
+bool ILSegment::mapbuffer()
+{
+	Mapping = Field.mapping();
+	if (!Mapping) return false;
+
+	const size_t offset = (size_t)fileposition();
+	if (offset + nbytes() > Mapping->size()){
+		std::printf("ILSegment::mapbuffer Error reading file %s\n", Field.datafilepath().c_str());
+		return false;
+	}
+
+	const char* p = Mapping->data() + offset;
+	switch (getTypeId()){
+	case IDataType::ID::FLOAT: mapdata(fdata, p); break;
+	case IDataType::ID::DOUBLE: mapdata(ddata, p); break;
+	case IDataType::ID::SHORT: mapdata(sdata, p); break;
+	case IDataType::ID::INT: mapdata(idata, p); break;
+	case IDataType::ID::UBYTE: mapdata(ubdata, p); break;
+	case IDataType::ID::STRING: mapdata(strdata, p, getType().size()); break;
+	default: std::printf("ILSegment::mapbuffer() Unknown type"); return false;
+	}
+	return true;
+}
+
 bool ILSegment::writebuffer()
 {
 	size_t n;
 	Field.open();
-	long move = fileposition() - ftell(filepointer());
-	fseek(filepointer(), move, SEEK_CUR);
+	//Absolute seek because positional reads (readat) may have moved the underlying file pointer
+	fseek(filepointer(), fileposition(), SEEK_SET);
 
 	switch (getTypeId()){
 	case IDataType::ID::FLOAT:
@@ -1731,6 +2554,7 @@ bool ILSegment::writebuffer()
 		printf("ILSegment::writebuffer Error writing to file %s\n", Field.datafilepath().c_str());
 		return false;
 	}
+	Field.getDataset().segmentcache().erase(Field, lineindex);
 	return true;
 }
 
@@ -1820,6 +2644,7 @@ bool ILField::create_new(const std::string& fieldname, const IDataType& _datatyp
 		glog.logmsg("Cannot create file: %s\n\n", datafilepath().c_str());
 		return false;
 	}
+	Writable = true;
 
 	if (fwrite((char*)hdata, IHeader::nbytes(), 1, pFile) != 1) {
 		glog.logmsg("Cannot write header: %s\n\n", datafilepath().c_str());
@@ -0,0 +1,168 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _memorymappedfile_H
+#define _memorymappedfile_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#if defined _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//Read-only memory mapping of a whole file
+class cMemoryMappedFile {
+
+private:
+	std::string FilePath;
+	const char* pData = nullptr;
+	size_t Size = 0;
+
+#if defined _WIN32
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	HANDLE hMapping = NULL;
+#else
+	int fd = -1;
+#endif
+
+	void take(cMemoryMappedFile& other) {
+		FilePath = std::move(other.FilePath);
+		pData = other.pData;
+		Size = other.Size;
+		other.pData = nullptr;
+		other.Size = 0;
+#if defined _WIN32
+		hFile = other.hFile;
+		hMapping = other.hMapping;
+		other.hFile = INVALID_HANDLE_VALUE;
+		other.hMapping = NULL;
+#else
+		fd = other.fd;
+		other.fd = -1;
+#endif
+	}
+
+public:
+
+	cMemoryMappedFile() {};
+
+	cMemoryMappedFile(const std::string& path) {
+		open(path);
+	};
+
+	cMemoryMappedFile(const cMemoryMappedFile&) = delete;
+	cMemoryMappedFile& operator=(const cMemoryMappedFile&) = delete;
+
+	cMemoryMappedFile(cMemoryMappedFile&& other) noexcept {
+		take(other);
+	};
+
+	cMemoryMappedFile& operator=(cMemoryMappedFile&& other) noexcept {
+		if (this != &other) {
+			close();
+			take(other);
+		}
+		return *this;
+	};
+
+	~cMemoryMappedFile() {
+		close();
+	};
+
+	bool open(const std::string& path) {
+		close();
+		FilePath = path;
+#if defined _WIN32
+		hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER sz;
+		if (GetFileSizeEx(hFile, &sz) == 0) {
+			close();
+			return false;
+		}
+		Size = (size_t)sz.QuadPart;
+		if (Size == 0) return true;//Nothing to map but a valid empty file
+		hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping == NULL) {
+			close();
+			return false;
+		}
+		pData = (const char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (pData == nullptr) {
+			close();
+			return false;
+		}
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close();
+			return false;
+		}
+		Size = (size_t)st.st_size;
+		if (Size == 0) return true;//Nothing to map but a valid empty file
+		void* p = mmap(nullptr, Size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			close();
+			return false;
+		}
+		pData = (const char*)p;
+#endif
+		return true;
+	};
+
+	void close() {
+#if defined _WIN32
+		if (pData) UnmapViewOfFile((LPCVOID)pData);
+		if (hMapping != NULL) CloseHandle(hMapping);
+		if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+		hMapping = NULL;
+		hFile = INVALID_HANDLE_VALUE;
+#else
+		if (pData) munmap((void*)pData, Size);
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+		pData = nullptr;
+		Size = 0;
+	};
+
+	bool isopen() const {
+#if defined _WIN32
+		return hFile != INVALID_HANDLE_VALUE;
+#else
+		return fd >= 0;
+#endif
+	};
+
+	const std::string& path() const { return FilePath; };
+
+	const char* data() const { return pData; };
+
+	const char* end() const { return pData + Size; };
+
+	size_t size() const { return Size; };
+
+	//Hint to the OS that the mapping will be read front to back
+	void advise_sequential() const {
+#if !defined _WIN32
+		if (pData) madvise((void*)pData, Size, MADV_SEQUENTIAL);
+#endif
+	};
+};
+
+#endif
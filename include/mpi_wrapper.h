@@ -311,6 +311,14 @@ public:
 		return s;
 	};
 
+	template < typename T >
+	T max(T& value){
+		T m;
+		int ierr = MPI_Allreduce(&value, &m, 1, cMpiEnv::mpitype(value), MPI_MAX, comm);
+		chkerr(ierr);
+		return m;
+	};
+
 	template < typename T >
 	double mean(T& value){	
 		return (double)sum(value)/size();
@@ -14,10 +14,19 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <cstring>
 #include <cstdarg>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <istream>
 #include <sstream>
 #include <iterator>
 #include <algorithm>
+#include <charconv>
+#include <clocale>
+#include <locale>
+#include <limits>
+#include <cmath>
+#include <cerrno>
+#include <type_traits>
 #include "undefinedvalues.h"
 
 template<typename T>
@@ -34,6 +43,114 @@ void str2num(const char* str, T& v)
 	ss >> v;
 }
 
+//strtod based conversion for when std::from_chars for floating point types is unavailable or the Fortran 'D' exponent needs replacing.
+//The '.' is swapped for the C locale's decimal point so that the result does not depend on the global locale.
+template<typename T>
+bool str2num_strtod(const std::string_view s, T& v)
+{
+	char buf[64];
+	std::string big;
+	char* p = buf;
+	if (s.size() >= sizeof(buf)) {
+		big.resize(s.size() + 1);
+		p = &big[0];
+	}
+	const char dp = *std::localeconv()->decimal_point;
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == 'D' || s[i] == 'd') p[i] = 'E';
+		else if (s[i] == '.') p[i] = dp;
+		else p[i] = s[i];
+	}
+	p[s.size()] = 0;
+	char* end;
+	errno = 0;
+	const double d = std::strtod(p, &end);
+	if (end == p) {
+		v = (T)0;
+		return false;
+	}
+	//Overflow (of double or of T) clamps to +-max like std::istringstream
+	const bool overflow = std::isinf(d) ? (errno == ERANGE) : (std::fabs(d) > (double)std::numeric_limits<T>::max());
+	if (overflow) {
+		v = d > 0 ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest();
+		return false;
+	}
+	v = (T)d;
+	return true;
+}
+
+//Fast alternative to str2num that does not depend on the global locale. For ordinary numbers it behaves like std::istringstream >> v
+//in the C locale: leading whitespace is skipped, trailing characters are ignored, v=0 on failure, overflow clamps v to the type's
+//max/lowest (returning false) and a negative value for an unsigned type wraps. Unlike the stream it also accepts nan and inf.
+//Also accepts Fortran style 'D' exponents (eg 1.5D+03) for floating point types.
+template<typename T>
+bool str2num_fast(std::string_view s, T& v)
+{
+	while (s.size() > 0 && std::isspace((unsigned char)s[0])) s.remove_prefix(1);
+	if (s.size() > 1 && s[0] == '+' && s[1] != '-') s.remove_prefix(1);//std::from_chars does not accept a leading '+'
+
+	if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>) {
+		std::istringstream iss{ std::string(s) };
+		iss.imbue(std::locale::classic());
+		iss >> v;
+		return !iss.fail();
+	}
+	else if constexpr (std::is_integral_v<T>) {
+		const bool negative = (s.size() > 0 && s[0] == '-');
+		if (std::is_unsigned_v<T> && negative) {
+			//The stream negates the magnitude modulo 2^n
+			T m;
+			const std::from_chars_result r = std::from_chars(s.data() + 1, s.data() + s.size(), m);
+			if (r.ec == std::errc() && r.ptr > s.data() + 1) {
+				v = (T)(T(0) - m);
+				return true;
+			}
+			v = (r.ec == std::errc::result_out_of_range) ? std::numeric_limits<T>::max() : (T)0;
+			return false;
+		}
+		const std::from_chars_result r = std::from_chars(s.data(), s.data() + s.size(), v);
+		if (r.ec == std::errc()) return true;
+		if (r.ec == std::errc::result_out_of_range) v = negative ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+		else v = (T)0;
+		return false;
+	}
+	else if constexpr (std::is_floating_point_v<T>) {
+#if defined __cpp_lib_to_chars
+		const char* last = s.data() + s.size();
+		const std::from_chars_result r = std::from_chars(s.data(), last, v);
+		if (r.ec == std::errc()) {
+			if (r.ptr < last && (*r.ptr == 'D' || *r.ptr == 'd')) {
+				return str2num_strtod(s, v);
+			}
+			return true;
+		}
+		//Out of range, strtod tells overflow (clamped) from underflow (the tiny or zero value)
+		if (r.ec == std::errc::result_out_of_range) return str2num_strtod(s, v);
+		v = (T)0;
+		return false;
+#else
+		return str2num_strtod(s, v);
+#endif
+	}
+	else {
+		std::istringstream iss{ std::string(s) };
+		iss.imbue(std::locale::classic());
+		iss >> v;
+		return !iss.fail();
+	}
+}
+
+//Converts a column/field string, empty strings or those matching nullstring become undefinedvalue<T>()
+template<typename T>
+bool field2num(const std::string_view s, T& v, const std::string_view nullstring = std::string_view())
+{
+	if (s.size() == 0 || (nullstring.size() > 0 && s == nullstring)) {
+		v = undefinedvalue<T>();
+		return false;
+	}
+	return str2num_fast(s, v);
+}
+
 inline std::string strprint_va(const char* fmt, va_list vargs)
 {
 	va_list vargscopy;
@@ -142,6 +259,67 @@ inline std::string trim(const std::string& s)
 	}
 }
 
+inline std::string_view trim_view(const std::string_view s)
+{
+	size_t index1 = s.find_first_not_of(" \t\r\n");
+	if (index1 == std::string_view::npos) return std::string_view();
+	size_t index2 = s.find_last_not_of(" \t\r\n");
+	return s.substr(index1, index2 - index1 + 1);
+}
+
+//True if all of s apart from surrounding whitespace is one number that str2num_fast would read as a double.
+//str2num_fast ignores trailing characters, so eg "1.000-2.000" converts but is not numeric here.
+inline bool isnumeric_string(const std::string_view s)
+{
+	std::string_view t = trim_view(s);
+	if (t.size() > 1 && t[0] == '+' && t[1] != '-') t.remove_prefix(1);
+	if (t.size() == 0) return false;
+	std::string c(t);
+	for (char& ch : c) if (ch == 'D' || ch == 'd') ch = 'E';
+	double v;
+#if defined __cpp_lib_to_chars
+	const std::from_chars_result r = std::from_chars(c.data(), c.data() + c.size(), v);
+	return (r.ec == std::errc() || r.ec == std::errc::result_out_of_range) && r.ptr == c.data() + c.size();
+#else
+	const char dp = *std::localeconv()->decimal_point;
+	for (char& ch : c) if (ch == '.') ch = dp;
+	char* end;
+	v = std::strtod(c.c_str(), &end);
+	return end != c.c_str() && end == c.c_str() + c.size();
+#endif
+}
+
+//Like fieldparsestring (strtok semantics, empty tokens skipped) but the tokens are views into str and tokens is reused
+inline size_t tokenise_view(const std::string_view str, const std::string_view delims, std::vector<std::string_view>& tokens)
+{
+	tokens.clear();
+	size_t p = str.find_first_not_of(delims);
+	while (p != std::string_view::npos) {
+		size_t q = str.find_first_of(delims, p);
+		if (q == std::string_view::npos) {
+			tokens.push_back(str.substr(p));
+			break;
+		}
+		tokens.push_back(str.substr(p, q - p));
+		p = str.find_first_not_of(delims, q);
+	}
+	return tokens.size();
+}
+
+//Number of tokens (strtok semantics) in str from position pos
+inline size_t count_tokens(const std::string_view str, const std::string_view delims, size_t pos = 0)
+{
+	size_t n = 0;
+	pos = str.find_first_not_of(delims, pos);
+	while (pos != std::string_view::npos) {
+		n++;
+		pos = str.find_first_of(delims, pos);
+		if (pos == std::string_view::npos) break;
+		pos = str.find_first_not_of(delims, pos);
+	}
+	return n;
+}
+
 inline std::vector<std::string> trimsplit(const std::string& str, const char delim) {
 	std::vector<std::string> elems;
 	split(str, delim, elems);